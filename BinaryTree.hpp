@@ -0,0 +1,220 @@
+//----------------------------------------
+//  Binary tree match finder over the sliding window, in the style of LZMA's BT4.
+//	Every position in the window is a node, and all positions sharing the same first two bytes hang off one
+//	head in a binary search tree ordered by the rest of their suffixes (up to max_search_len bytes).
+//	Inserting a position walks down from the head, and the nodes it passes on the way are exactly the
+//	closest suffixes on either side, so the same walk reports all the improving matches in one pass.
+//	Memory is two ints per window byte plus the heads, independent of the input size.
+//	Drop-in for SuffixTree: add_next_letter() and find_longest_match_after() behave the same way.
+//----------------------------------------
+
+#ifndef __BINARYTREE_HEADER_GUARD__
+#define __BINARYTREE_HEADER_GUARD__
+
+#include <vector>
+#include <cassert>
+#include <utility>
+#include <algorithm>
+
+#include "MatchLength.hpp"
+
+class BinaryTree
+{
+	public:
+
+		// rv.first = position, rv.second = length
+		typedef std::pair<int,int> Match;
+
+	private:
+
+		enum { NUM_HEADS = 1 << 16, NIL = -1 };
+		// skip_letters() only indexes every this many positions
+		enum { SKIP_STRIDE = 4 };
+
+		const std::vector<BYTE>& chars;
+		int max_search_len;
+		int window;
+		int cyclic_size;
+		// how many nodes one walk may visit before giving up
+		int max_depth;
+
+		std::vector<int> heads;
+		// son[2*slot] is the smaller subtree, son[2*slot+1] the bigger one
+		std::vector<int> son;
+
+		int curr_i;
+
+		// the matches found when curr_i was inserted, if it already was
+		int searched_i;
+		std::vector<Match> found;
+		size_t found_steps;
+
+		int slot( int pos ) const { return pos % cyclic_size; }
+
+		//----------------------------------------
+		//  Inserts curr_i into its tree, appending every improving match seen on the way to 'matches' (if non-NULL).
+		//	Returns the number of nodes visited.
+		//----------------------------------------
+		size_t insert( std::vector<Match>* matches )
+		{
+			int cur = curr_i;
+			int len_limit = std::min( max_search_len, (int)chars.size() - cur );
+			if( len_limit < 2 )
+				// too close to the end to ever be part of a match
+				return 0;
+
+			int key = (chars[cur] << 8) | chars[cur+1];
+			int cur_match = heads[key];
+			heads[key] = cur;
+
+			int* ptr1 = &son[ 2*slot(cur) ];
+			int* ptr0 = &son[ 2*slot(cur)+1 ];
+			// everything under this head agrees on the first two bytes
+			int len0 = 2;
+			int len1 = 2;
+			int best_len = 1;
+			size_t steps = 0;
+			int depth = max_depth;
+
+			while( true )
+			{
+				if( cur_match == NIL || cur - cur_match > window || depth-- == 0 )
+				{
+					*ptr0 = *ptr1 = NIL;
+					break;
+				}
+				steps++;
+
+				int* pair = &son[ 2*slot(cur_match) ];
+				int len = std::min( len0, len1 );
+				len += match_length( &chars[cur_match+len], &chars[cur+len], len_limit-len );
+
+				// the copy can't run into the bytes it's producing
+				int usable = std::min( len, cur - cur_match );
+				if( usable > best_len )
+				{
+					best_len = usable;
+					if( matches != NULL )
+						matches->push_back( Match( cur_match, usable ) );
+				}
+
+				if( len == len_limit )
+				{
+					// identical as far as we look, so cur takes over the old node's place and children
+					*ptr1 = pair[0];
+					*ptr0 = pair[1];
+					break;
+				}
+
+				if( chars[cur_match+len] < chars[cur+len] )
+				{
+					*ptr1 = cur_match;
+					ptr1 = &pair[1];
+					cur_match = *ptr1;
+					len1 = len;
+				}
+				else
+				{
+					*ptr0 = cur_match;
+					ptr0 = &pair[0];
+					cur_match = *ptr0;
+					len0 = len;
+				}
+			}
+
+			return steps;
+		}
+
+	public:
+
+		enum { DEFAULT_MAX_DEPTH = 64 };
+
+		BinaryTree( const std::vector<BYTE>& _chars, int _max_search_len, int _window, int _max_depth = DEFAULT_MAX_DEPTH ) :
+			chars( _chars ),
+			max_search_len( _max_search_len ),
+			window( _window ),
+			cyclic_size( _window+1 ),
+			max_depth( _max_depth ),
+			heads( NUM_HEADS, NIL ),
+			son( 2*(_window+1), NIL ),
+			curr_i( 0 ),
+			searched_i( -1 ),
+			found_steps( 0 )
+		{
+		}
+
+		//----------------------------------------
+		//  Returns false if all done
+		//----------------------------------------
+		bool add_next_letter()
+		{
+			if( curr_i < (int)chars.size() )
+			{
+				if( searched_i != curr_i )
+					insert( NULL );
+				curr_i++;
+				return true;
+			}
+			else
+				return false;
+		}
+
+		//----------------------------------------
+		//  Moves past n positions, but only indexes every SKIP_STRIDE'th one and the last two.
+		//	Meant for the inside of a copy, which mostly repeats what's already indexed at its source.
+		//----------------------------------------
+		void skip_letters( int n )
+		{
+			for( int j = 0; j < n && curr_i < (int)chars.size(); j++ )
+			{
+				if( searched_i != curr_i && (j % SKIP_STRIDE == 0 || j >= n-2) )
+					insert( NULL );
+				curr_i++;
+			}
+		}
+
+		//----------------------------------------
+		//  All the improving matches for the next letter's position (ie. the one add_next_letter() would add),
+		//	in order of increasing length, that start at or after min_pos.
+		//	This inserts the position too, so the following add_next_letter() is free.
+		//----------------------------------------
+		const std::vector<Match>& find_all_matches( int min_pos, size_t* num_steps = NULL )
+		{
+			if( searched_i != curr_i )
+			{
+				found.clear();
+				found_steps = insert( &found );
+				searched_i = curr_i;
+			}
+
+			if( num_steps != NULL )
+				*num_steps += found_steps;
+
+			// the window check during insert is normally at least as strict as min_pos, but just in case
+			int kept = 0;
+			for( int m = 0; m < (int)found.size(); m++ )
+			{
+				if( found[m].first >= min_pos )
+					found[kept++] = found[m];
+			}
+			found.resize( kept );
+
+			return found;
+		}
+
+		//----------------------------------------
+		//  Same contract as SuffixTree::find_longest_match_after. The target must be the bytes at the next letter's position.
+		//----------------------------------------
+		std::pair<int,int> find_longest_match_after( const std::vector<BYTE>& target, int min_pos, size_t* num_steps = NULL )
+		{
+			assert( target.empty() || target[0] == chars[curr_i] );
+
+			// the last improving match is the longest
+			const std::vector<Match>& matches = find_all_matches( min_pos, num_steps );
+			if( matches.empty() )
+				return std::pair<int,int>( -1, 0 );
+			return std::pair<int,int>( matches.back().first, std::min( matches.back().second, (int)target.size() ) );
+		}
+};
+
+#endif /* end of include guard: __BINARYTREE_HEADER_GUARD__ */
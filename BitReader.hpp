@@ -15,31 +15,15 @@ class BitReader
 
 		static bool load_bytes_binary( std::vector<BYTE>& bytes, const std::string& fname )
 		{
-			std::ifstream fin( fname.c_str(), std::ios::binary );
-			if( !fin.good() )
+			PROFILE_SCOPE( "load" );
+			if( !file_io::read_file( fname, bytes ) )
 			{
 				std::cerr << "** Could not open file for read '" << fname.c_str() << "'" << std::endl;
 				return false;
 			}
-			else
-			{
-				bytes.clear();
-
-				while( true )
-				{
-					BYTE byte;
-					fin.read( (char*)&byte, sizeof(byte) );
-
-					if( fin.eof() )
-						break;
-
-					bytes.push_back( byte );
-				}
 
-				fin.close();
-				std::cout << "OK Loaded " << bytes.size() << " bytes from " << fname << std::endl;
-				return true;
-			}
+			std::cout << "OK Loaded " << bytes.size() << " bytes from " << fname << std::endl;
+			return true;
 		}
 
 		BitReader() :
@@ -57,6 +41,15 @@ class BitReader
 			return load_bytes_binary( bytes, fname );
 		}
 
+		//----------------------------------------
+		//  Reads from a copy of the given bytes instead of a file, starting over from the first bit
+		//----------------------------------------
+		void assign( const BYTE* data, size_t len )
+		{
+			bytes.assign( data, data+len );
+			next_bit = 0;
+		}
+
 		//----------------------------------------
 		//  IMPORTANT: This returns TRUE is there was a bit to read, and false otherwise.
 		//	The actual value is assigned to val
@@ -73,21 +66,30 @@ class BitReader
 				return false;
 		}
 
+		//----------------------------------------
+		//  Reads num_places bits into the low bits of out, as write_bits() wrote them.
+		//	Returns false if there aren't that many left.
+		//----------------------------------------
 		template <typename T>
 		bool read_bits( T& out, unsigned int num_places )
 		{
-			for( int i = 0; i < std::min((size_t)num_places, 8*sizeof(T)); i++ )
+			num_places = std::min( (size_t)num_places, 8*sizeof(T) );
+			if( next_bit + num_places > bytes.size()*8 )
+				// no more left to read
+				return false;
+
+			uint64_t bits = 0;
+			for( unsigned int got = 0; got < num_places; )
 			{
-				bool val;
-				if( read_bit( val ) )
-				{
-					BitWriter::set_bit( out, i, val );
-				}
-				else
-					// no more left to read
-					return false;
-				
+				int used = next_bit % 8;
+				int take = std::min( 8 - used, (int)(num_places - got) );
+				bits |= (uint64_t)((bytes[ next_bit / 8 ] >> used) & ((1u << take) - 1)) << got;
+				got += take;
+				next_bit += take;
 			}
+
+			uint64_t mask = num_places >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << num_places) - 1;
+			out = (T)(((uint64_t)out & ~mask) | bits);
 			return true;
 		}
 
@@ -7,6 +7,11 @@
 #include <string>
 #include <cassert>
 #include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Profile.hpp"
+#include "FileIO.hpp"
 
 typedef unsigned char BYTE;
 
@@ -59,23 +64,16 @@ class BitWriter
 
 		static bool save_bytes_binary( const std::vector<BYTE>& bytes, const std::string& fname )
 		{
-			std::ofstream fout( fname.c_str(), std::ios::binary );
-			if( !fout.good() )
+			PROFILE_SCOPE( "save" );
+			// all in one go, not a byte at a time
+			if( !file_io::write_file( fname, bytes.data(), bytes.size() ) )
 			{
-				std::cerr << "** Could not open file for write '" << fname << "'" << std::endl;
+				std::cerr << "** Could not write file '" << fname << "'" << std::endl;
 				return false;
 			}
-			else
-			{
-				for( int i = 0; i < bytes.size(); i++ )
-				{
-					fout.write( (char*)&bytes[i], sizeof( bytes[i] ) );
-				}
-			
-				fout.close();
-				std::cout << "OK Saved " << bytes.size() << " bytes to " << fname << std::endl;
-				return true;
-			}
+
+			std::cout << "OK Saved " << bytes.size() << " bytes to " << fname << std::endl;
+			return true;
 		}
 
 		void to_ascii( std::ostream& os )
@@ -102,6 +100,14 @@ class BitWriter
 			next_bit++;
 		}
 
+		const std::vector<BYTE>& get_bytes() const { return bytes; }
+
+		void clear()
+		{
+			bytes.clear();
+			next_bit = 0;
+		}
+
 		bool save_binary( const std::string& fname )
 		{
 			std::cout << "Saving " << next_bit << " bits to " << fname << std::endl;
@@ -109,14 +115,25 @@ class BitWriter
 		}
 
 		//----------------------------------------
-		//  Writes the given value as num_places bits, starting from LSB
+		//  Writes the given value as num_places bits, starting from LSB.
+		//	Same as a write_bit() per bit, but as many at a time as fit in the current byte.
 		//----------------------------------------
 		template <typename T>
 		void write_bits( T value, unsigned int num_places )
 		{
-			for( int i = 0; i < std::min((size_t)num_places, 8*sizeof(T)); i++ )
+			num_places = std::min( (size_t)num_places, 8*sizeof(T) );
+			uint64_t bits = (uint64_t)value;
+			while( num_places > 0 )
 			{
-				write_bit( get_bit( value, i ) );
+				int used = next_bit % 8;
+				if( used == 0 )
+					bytes.push_back( 0 );
+				int take = std::min( 8 - used, (int)num_places );
+				// bits past the end are all still 0, so they can just be or'ed in
+				bytes.back() |= (BYTE)((bits & ((1u << take) - 1)) << used);
+				bits >>= take;
+				num_places -= take;
+				next_bit += take;
 			}
 		}
 };
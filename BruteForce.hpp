@@ -0,0 +1,198 @@
+//----------------------------------------
+//  Exact brute force match search over a window. This is the "ground truth" that the smarter match finders
+//	are checked against, so it must stay guaranteed-optimal: it returns the EARLIEST position with the longest match.
+//	Rather than trying every position, it scans the window in vector lanes for positions that agree with the
+//	target on both the first byte and the byte just past the current best, and only extends those.
+//	A better match has to agree on both, so nothing is missed.
+//----------------------------------------
+
+#ifndef __BRUTEFORCE_HEADER_GUARD__
+#define __BRUTEFORCE_HEADER_GUARD__
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "MatchLength.hpp"
+
+namespace brute_force_impl
+{
+	struct Search
+	{
+		const BYTE* pile;
+		int pile_end;
+		const BYTE* target;
+		int target_len;
+
+		int best_pos;
+		int best_len;
+		size_t steps;
+
+		//----------------------------------------
+		//  Extends the candidate at p. Returns true if the target was matched completely, so we can stop.
+		//----------------------------------------
+		bool consider( int p )
+		{
+			steps++;
+			int len = match_length( pile+p, target, std::min( target_len, pile_end-p ) );
+			if( len > best_len )
+			{
+				best_len = len;
+				best_pos = p;
+			}
+			return best_len == target_len;
+		}
+
+		//----------------------------------------
+		//  A position can only beat the best if it has room for one more byte
+		//----------------------------------------
+		bool has_room( int p ) const
+		{
+			return p + best_len < pile_end;
+		}
+	};
+
+	inline void scan_scalar( Search& s, int p )
+	{
+		for( ; s.has_room( p ); p++ )
+		{
+			if( s.pile[p] == s.target[0] && s.pile[p+s.best_len] == s.target[s.best_len] )
+			{
+				if( s.consider( p ) )
+					return;
+			}
+		}
+	}
+
+#ifdef ALZ_X86_SIMD
+	inline void scan_sse2( Search& s, int p )
+	{
+		__m128i first = _mm_set1_epi8( s.target[0] );
+		// both loads have to stay inside the pile
+		while( p + s.best_len + 16 <= s.pile_end )
+		{
+			s.steps++;
+			__m128i at = _mm_set1_epi8( s.target[s.best_len] );
+			__m128i eq_first = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)(s.pile+p) ), first );
+			__m128i eq_at = _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)(s.pile+p+s.best_len) ), at );
+			unsigned int mask = _mm_movemask_epi8( _mm_and_si128( eq_first, eq_at ) );
+			while( mask != 0 )
+			{
+				if( s.consider( p + __builtin_ctz( mask ) ) )
+					return;
+				mask &= mask-1;
+			}
+			p += 16;
+		}
+		scan_scalar( s, p );
+	}
+
+	__attribute__((target("avx2")))
+	inline void scan_avx2( Search& s, int p )
+	{
+		__m256i first = _mm256_set1_epi8( s.target[0] );
+		while( p + s.best_len + 32 <= s.pile_end )
+		{
+			s.steps++;
+			__m256i at = _mm256_set1_epi8( s.target[s.best_len] );
+			__m256i eq_first = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)(s.pile+p) ), first );
+			__m256i eq_at = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)(s.pile+p+s.best_len) ), at );
+			unsigned int mask = _mm256_movemask_epi8( _mm256_and_si256( eq_first, eq_at ) );
+			while( mask != 0 )
+			{
+				if( s.consider( p + __builtin_ctz( mask ) ) )
+					return;
+				mask &= mask-1;
+			}
+			p += 32;
+		}
+		scan_scalar( s, p );
+	}
+#endif
+
+	typedef void (*Scanner)( Search&, int );
+
+	inline Scanner pick_scanner()
+	{
+#ifdef ALZ_X86_SIMD
+		if( __builtin_cpu_supports( "avx2" ) )
+			return scan_avx2;
+		if( __builtin_cpu_supports( "sse2" ) )
+			return scan_sse2;
+#endif
+		return scan_scalar;
+	}
+
+	inline Scanner scanner()
+	{
+		static const Scanner sc = pick_scanner();
+		return sc;
+	}
+}
+
+//----------------------------------------
+//  The original one-position-at-a-time search, kept to check the vectorized one against
+//----------------------------------------
+inline int find_longest_match_naive( const std::vector<BYTE>& pile, int pile_start, int pile_end, const std::vector<BYTE>& target, int& best_len )
+{
+	assert( pile_end <= (int)pile.size() );
+
+	int best_match = -1;
+	best_len = -1;
+	for( int i = pile_start; i < pile_end; i++ )
+	{
+		int curr_len = 0;
+		for( int j = 0; j < (int)target.size() && (i+j) < pile_end; j++ )
+		{
+			if( pile[i+j] == target[j] )
+				curr_len++;
+			else
+				break;
+		}
+
+		if( curr_len > best_len )
+		{
+			best_match = i;
+			best_len = curr_len;
+		}
+	}
+
+	return best_match;
+}
+
+//----------------------------------------
+//  Finds the earliest longest match of target inside pile[pile_start, pile_end), without running past pile_end.
+//	Same results as find_longest_match_naive: if nothing matches at all, that's pile_start with best_len 0,
+//	and an empty pile gives -1 with best_len -1.
+//	If num_steps is given, the number of vector blocks scanned plus candidates extended is added to it
+//----------------------------------------
+inline int find_longest_match( const std::vector<BYTE>& pile, int pile_start, int pile_end, const std::vector<BYTE>& target, int& best_len, size_t* num_steps = NULL )
+{
+	assert( pile_end <= (int)pile.size() );
+
+	if( pile_start >= pile_end )
+	{
+		best_len = -1;
+		return -1;
+	}
+
+	brute_force_impl::Search s;
+	s.pile = &pile[0];
+	s.pile_end = pile_end;
+	s.target = target.empty() ? NULL : &target[0];
+	s.target_len = target.size();
+	s.best_pos = pile_start;
+	s.best_len = 0;
+	s.steps = 0;
+
+	if( s.target_len > 0 )
+		brute_force_impl::scanner()( s, pile_start );
+
+	if( num_steps != NULL )
+		*num_steps += s.steps;
+
+	best_len = s.best_len;
+	return s.best_pos;
+}
+
+#endif /* end of include guard: __BRUTEFORCE_HEADER_GUARD__ */
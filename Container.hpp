@@ -0,0 +1,191 @@
+//----------------------------------------
+//  The .alz container: a small header, then a sequence of independently typed blocks.
+//
+//	header:  'A' 'L' 'Z' version window_bits
+//	block:   type (1 byte), raw length (4 bytes LE), payload length (4 bytes LE), payload
+//	end:     a single BLOCK_END type byte
+//
+//	Copies in a block may reach back into earlier blocks' output, so blocks share one history.
+//	window_bits is how wide a copy's delta field is, so copies reach back up to 2^window_bits bytes.
+//	Version 1 files have no window_bits byte, and always use 12.
+//	Files without the header are the original headerless bit stream, which the decoder still reads.
+//----------------------------------------
+
+#ifndef __CONTAINER_HEADER_GUARD__
+#define __CONTAINER_HEADER_GUARD__
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "BitWriter.hpp"
+
+namespace container
+{
+	static const BYTE MAGIC[3] = { 'A', 'L', 'Z' };
+	static const BYTE VERSION = 2;
+	static const int HEADER_SIZE = 5;
+	static const int V1_HEADER_SIZE = 4;
+
+	// from the original 4KB window up to 64MB
+	static const int DEFAULT_WINDOW_BITS = 12;
+	static const int MIN_WINDOW_BITS = 12;
+	static const int MAX_WINDOW_BITS = 26;
+	static const int BLOCK_HEADER_SIZE = 9;
+
+	// how much input goes into each block
+	static const int BLOCK_SIZE = 1 << 16;
+
+	// blocks whose byte distribution is at least this random are only worth probing for repeats of earlier data
+	static const double INCOMPRESSIBLE_BITS_PER_BYTE = 7.9;
+
+	enum BlockType
+	{
+		BLOCK_END = 0,
+		// the original flag bit + literal / copy command bit stream
+		BLOCK_BITS = 1,
+		// raw bytes, for when compressing doesn't pay
+		BLOCK_STORED = 2,
+		// a long repeat from anywhere earlier in the output. The payload is where it starts (4 bytes LE).
+		BLOCK_COPY = 3,
+		// Only ever first: the output is preceded by raw_len bytes of dictionary, which the decoder has to be given
+		// and which aren't part of the output. The payload is the dictionary's checksum (4 bytes LE).
+		BLOCK_DICT = 4,
+		// byte-aligned literal run + copy sequences (see TokenFormat.hpp)
+		BLOCK_TOKENS = 5,
+		// bit format commands with their flags packed 32 to a word ahead of them (see FlagFormat.hpp)
+		BLOCK_FLAGS = 6,
+		// the token format's fields split into separate streams of lengths, literals and deltas (see StreamFormat.hpp)
+		BLOCK_STREAMS = 7
+	};
+
+	inline void write_u32( std::vector<BYTE>& out, uint32_t x )
+	{
+		for( int b = 0; b < 4; b++ )
+			out.push_back( (x >> (8*b)) & 0xff );
+	}
+
+	inline uint32_t read_u32( const BYTE* p )
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	inline void write_header( std::vector<BYTE>& out, int window_bits )
+	{
+		out.insert( out.end(), MAGIC, MAGIC+3 );
+		out.push_back( VERSION );
+		out.push_back( window_bits );
+	}
+
+	inline bool has_header( const std::vector<BYTE>& in )
+	{
+		return in.size() >= V1_HEADER_SIZE && in[0] == MAGIC[0] && in[1] == MAGIC[1] && in[2] == MAGIC[2] && (in[3] == 1 || in[3] == VERSION);
+	}
+
+	//----------------------------------------
+	//  For a file that has_header(), gets the window size and where the first block starts.
+	//	Returns false if the header is cut short or the window isn't one we'd write.
+	//----------------------------------------
+	inline bool read_header( const std::vector<BYTE>& in, int& window_bits, size_t& header_size )
+	{
+		if( in[3] == 1 )
+		{
+			window_bits = DEFAULT_WINDOW_BITS;
+			header_size = V1_HEADER_SIZE;
+			return true;
+		}
+
+		if( in.size() < HEADER_SIZE )
+			return false;
+		window_bits = in[4];
+		header_size = HEADER_SIZE;
+		return window_bits >= MIN_WINDOW_BITS && window_bits <= MAX_WINDOW_BITS;
+	}
+
+	inline void write_block( std::vector<BYTE>& out, BlockType type, uint32_t raw_len, const BYTE* payload, uint32_t payload_len )
+	{
+		out.push_back( type );
+		write_u32( out, raw_len );
+		write_u32( out, payload_len );
+		out.insert( out.end(), payload, payload+payload_len );
+	}
+
+	inline void write_copy_block( std::vector<BYTE>& out, uint32_t raw_len, uint32_t src )
+	{
+		out.push_back( BLOCK_COPY );
+		write_u32( out, raw_len );
+		write_u32( out, 4 );
+		write_u32( out, src );
+	}
+
+	inline void write_dict_block( std::vector<BYTE>& out, uint32_t dict_len, uint32_t checksum )
+	{
+		out.push_back( BLOCK_DICT );
+		write_u32( out, dict_len );
+		write_u32( out, 4 );
+		write_u32( out, checksum );
+	}
+
+	inline void write_end( std::vector<BYTE>& out )
+	{
+		out.push_back( BLOCK_END );
+	}
+
+	//----------------------------------------
+	//  Appends num_bytes from out[copy_start] onwards to out, which may run on into the bytes being appended
+	//----------------------------------------
+	inline void append_copy( std::vector<BYTE>& out, size_t copy_start, size_t num_bytes )
+	{
+		size_t old_size = out.size();
+		if( copy_start == old_size-1 )
+		{
+			// a run of the previous byte
+			out.insert( out.end(), num_bytes, out.back() );
+		}
+		else if( copy_start + num_bytes <= old_size )
+		{
+			// the source is entirely behind us, so copy it all at once
+			out.resize( old_size + num_bytes );
+			memcpy( &out[old_size], &out[copy_start], num_bytes );
+		}
+		else
+		{
+			// overlapping, so this repeats bytes the copy itself is writing
+			out.resize( old_size + num_bytes );
+			for( size_t i = 0; i < num_bytes; i++ )
+				out[old_size+i] = out[copy_start+i];
+		}
+	}
+
+	//----------------------------------------
+	//  Order-0 entropy of the given bytes, in bits per byte
+	//----------------------------------------
+	inline double entropy( const BYTE* bytes, int n )
+	{
+		if( n == 0 )
+			return 0;
+
+		int counts[256] = { 0 };
+		for( int i = 0; i < n; i++ )
+			counts[ bytes[i] ]++;
+
+		double bits = 0;
+		for( int c = 0; c < 256; c++ )
+		{
+			if( counts[c] > 0 )
+			{
+				double p = (double)counts[c] / n;
+				bits -= p * log2( p );
+			}
+		}
+		return bits;
+	}
+
+	inline bool looks_incompressible( const BYTE* bytes, int n )
+	{
+		return entropy( bytes, n ) >= INCOMPRESSIBLE_BITS_PER_BYTE;
+	}
+}
+
+#endif /* end of include guard: __CONTAINER_HEADER_GUARD__ */
@@ -0,0 +1,139 @@
+//----------------------------------------
+//  Shared dictionaries, for inputs too small to find much in themselves.
+//	A dictionary is just bytes that both sides pretend came before the input, so copies can reach back into it.
+//	Training picks them in the style of zstd's COVER [Liao, Petri, Moffat & Wirth 2016]: the samples are split
+//	into one epoch per dictionary segment, and from each epoch we take the SEGMENT_LEN-byte segment whose
+//	DMER_LEN-byte substrings turn up in the most samples. Substrings already taken score nothing after that.
+//	The first segments picked go at the end, nearest the input, where they stay in the window longest.
+//----------------------------------------
+
+#ifndef __DICTIONARY_HEADER_GUARD__
+#define __DICTIONARY_HEADER_GUARD__
+
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <stdint.h>
+
+#include "MatchLength.hpp"
+
+namespace dictionary
+{
+	static const int SEGMENT_LEN = 64;
+	static const int DMER_LEN = 8;
+
+	//----------------------------------------
+	//  FNV-1a, so the decoder can tell it's been given the dictionary the file was compressed with
+	//----------------------------------------
+	inline uint32_t checksum( const std::vector<BYTE>& bytes )
+	{
+		uint32_t h = 2166136261u;
+		for( size_t i = 0; i < bytes.size(); i++ )
+		{
+			h ^= bytes[i];
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+	inline uint64_t load_dmer( const BYTE* p )
+	{
+		uint64_t x = 0;
+		memcpy( &x, p, DMER_LEN );
+		return x;
+	}
+
+	//----------------------------------------
+	//  Builds a dictionary of at most dict_size bytes from the samples
+	//----------------------------------------
+	inline std::vector<BYTE> train( const std::vector< std::vector<BYTE> >& samples, size_t dict_size )
+	{
+		// all the samples end to end, remembering where each one ends so segments don't straddle two
+		std::vector<BYTE> all;
+		std::vector<size_t> sample_end;
+		for( size_t s = 0; s < samples.size(); s++ )
+		{
+			all.insert( all.end(), samples[s].begin(), samples[s].end() );
+			sample_end.push_back( all.size() );
+		}
+
+		// how many samples each dmer is in
+		std::unordered_map<uint64_t,int> freq;
+		{
+			std::unordered_map<uint64_t,int> last_sample;
+			size_t start = 0;
+			for( size_t s = 0; s < samples.size(); s++ )
+			{
+				for( size_t i = start; i + DMER_LEN <= sample_end[s]; i++ )
+				{
+					uint64_t d = load_dmer( &all[i] );
+					std::unordered_map<uint64_t,int>::iterator it = last_sample.find( d );
+					if( it == last_sample.end() || it->second != (int)s )
+					{
+						last_sample[d] = s;
+						freq[d]++;
+					}
+				}
+				start = sample_end[s];
+			}
+		}
+
+		std::vector<BYTE> dict( dict_size );
+		size_t filled = 0;
+		size_t num_epochs = std::max( (size_t)1, dict_size / SEGMENT_LEN );
+		size_t epoch_len = std::max( (size_t)SEGMENT_LEN, all.size() / num_epochs );
+
+		for( size_t epoch_start = 0; epoch_start < all.size() && filled < dict_size; epoch_start += epoch_len )
+		{
+			size_t epoch_end = std::min( epoch_start + epoch_len, all.size() );
+			size_t s = 0;
+			while( sample_end[s] <= epoch_start )
+				s++;
+
+			// slide a segment through the epoch, scoring it by how common its dmers are
+			size_t best_pos = 0;
+			long best_score = 0;
+			for( size_t seg = epoch_start; seg + SEGMENT_LEN <= epoch_end; )
+			{
+				if( seg + SEGMENT_LEN > sample_end[s] )
+				{
+					// would straddle two samples
+					seg = sample_end[s++];
+					continue;
+				}
+
+				long score = 0;
+				for( size_t i = seg; i + DMER_LEN <= seg + SEGMENT_LEN; i++ )
+				{
+					std::unordered_map<uint64_t,int>::const_iterator it = freq.find( load_dmer( &all[i] ) );
+					if( it != freq.end() && it->second > 1 )
+						score += it->second;
+				}
+				if( score > best_score )
+				{
+					best_score = score;
+					best_pos = seg;
+				}
+				// segments overlapping this much mostly score the same, so don't try every position
+				seg += DMER_LEN;
+			}
+
+			if( best_score == 0 )
+				continue;
+
+			// taken, so these don't count towards any other segment
+			for( size_t i = best_pos; i + DMER_LEN <= best_pos + SEGMENT_LEN; i++ )
+				freq[ load_dmer( &all[i] ) ] = 0;
+
+			size_t len = std::min( (size_t)SEGMENT_LEN, dict_size - filled );
+			filled += len;
+			memcpy( &dict[ dict_size - filled ], &all[best_pos], len );
+		}
+
+		// if there weren't enough good segments, drop the unfilled front
+		dict.erase( dict.begin(), dict.begin() + (dict_size - filled) );
+		return dict;
+	}
+}
+
+#endif /* end of include guard: __DICTIONARY_HEADER_GUARD__ */
@@ -0,0 +1,332 @@
+//----------------------------------------
+//  Quiet whole-file reads and writes, and directory listing, for batch mode.
+//	Unlike BitReader::load_bytes_binary / BitWriter::save_bytes_binary these don't print anything,
+//	so many threads can use them at once without their messages getting mixed up.
+//	With use_io_uring() on, reads and writes go through an io_uring per thread (see IoUring.hpp), with several
+//	requests queued per system call; otherwise, or if the kernel won't give us one, plain pread()s and pwrite()s.
+//	Pipes, FIFOs and the like can't be read or written at an offset, so they always get plain read()s and write()s.
+//	Writes are as big as the caller gives them (pwrite() splits nothing itself), and sync_policy() says whether
+//	finished files are flushed to the disk before they count as written.
+//----------------------------------------
+
+#ifndef __FILEIO_HEADER_GUARD__
+#define __FILEIO_HEADER_GUARD__
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "MatchLength.hpp"
+#include "Profile.hpp"
+#include "IoUring.hpp"
+
+namespace file_io
+{
+	//----------------------------------------
+	//  Whether to use io_uring where there is one. Off unless asked for (alz --uring).
+	//----------------------------------------
+	inline std::atomic<bool>& use_io_uring()
+	{
+		static std::atomic<bool> on( false );
+		return on;
+	}
+
+	//----------------------------------------
+	//  What to do about the disk when an output file is closed
+	//----------------------------------------
+	enum SyncPolicy
+	{
+		// leave it to the page cache, the fastest
+		SYNC_NONE,
+		// fdatasync(), so the data's on the disk, if not all the metadata like the modified time
+		SYNC_DATA,
+		// fsync(), data and metadata both
+		SYNC_FULL
+	};
+
+	// how much read_file() starts with when it can't tell how big a file is
+	static const size_t MIN_READ_SIZE = 1 << 16;
+
+	inline std::atomic<int>& sync_policy()
+	{
+		static std::atomic<int> policy( SYNC_NONE );
+		return policy;
+	}
+
+	//----------------------------------------
+	//  This thread's ring, or NULL to use plain reads and writes
+	//----------------------------------------
+	inline IoUring* thread_ring()
+	{
+		if( !use_io_uring() )
+			return NULL;
+		static thread_local IoUring ring;
+		return ring.ok() ? &ring : NULL;
+	}
+
+	//----------------------------------------
+	//  Whether fd is a regular file, which can be read and written at offsets. Pipes, FIFOs and terminals
+	//	can only be read and written in order.
+	//----------------------------------------
+	inline bool is_seekable( int fd )
+	{
+		struct stat st;
+		return fstat( fd, &st ) == 0 && S_ISREG( st.st_mode );
+	}
+
+	//----------------------------------------
+	//  Reads len bytes from offset, or from wherever fd is up to if it isn't seekable. got is less only at the end.
+	//----------------------------------------
+	inline bool pread_all( int fd, bool seekable, BYTE* dst, size_t len, uint64_t offset, size_t& got )
+	{
+		got = 0;
+		while( got < len )
+		{
+			ssize_t n = seekable ? pread( fd, dst + got, len - got, offset + got ) : ::read( fd, dst + got, len - got );
+			if( n < 0 && errno == EINTR )
+				continue;
+			if( n < 0 )
+				return false;
+			if( n == 0 )
+				break;
+			got += n;
+		}
+		return true;
+	}
+
+	inline bool pwrite_all( int fd, bool seekable, const BYTE* src, size_t len, uint64_t offset )
+	{
+		size_t done = 0;
+		while( done < len )
+		{
+			ssize_t n = seekable ? pwrite( fd, src + done, len - done, offset + done ) : ::write( fd, src + done, len - done );
+			if( n < 0 && errno == EINTR )
+				continue;
+			if( n <= 0 )
+				return false;
+			done += n;
+		}
+		return true;
+	}
+
+	//----------------------------------------
+	//  A file read from front to back in big stretches
+	//----------------------------------------
+	class InputFile
+	{
+		private:
+
+			int fd;
+			// pipes and the like are read in order, without io_uring
+			bool seekable;
+			uint64_t offset;
+			bool failed;
+
+		public:
+
+			InputFile( const std::string& fname ) :
+				fd( open( fname.c_str(), O_RDONLY ) ),
+				seekable( is_seekable( fd ) ),
+				offset( 0 ),
+				failed( false )
+			{
+			}
+
+			~InputFile()
+			{
+				if( fd >= 0 )
+					close( fd );
+			}
+
+			bool good() const { return fd >= 0 && !failed; }
+
+			//----------------------------------------
+			//  What's left to read, as far as the file system knows. Only a hint: 0 for a pipe, and a file may grow.
+			//----------------------------------------
+			size_t remaining() const
+			{
+				struct stat st;
+				return seekable && fstat( fd, &st ) == 0 && (uint64_t)st.st_size > offset ? st.st_size - offset : 0;
+			}
+
+			//----------------------------------------
+			//  Reads up to len bytes into dst, fewer only at the end of the file, and returns how many
+			//----------------------------------------
+			size_t read( BYTE* dst, size_t len )
+			{
+				if( !good() )
+					return 0;
+
+				size_t got = 0;
+				IoUring* ring = seekable ? thread_ring() : NULL;
+				if( ring == NULL || !ring->read( fd, dst, len, offset, got ) )
+					failed = !pread_all( fd, seekable, dst, len, offset, got );
+				offset += got;
+				return got;
+			}
+	};
+
+	//----------------------------------------
+	//  A file written from front to back, replacing whatever was there
+	//----------------------------------------
+	class OutputFile
+	{
+		private:
+
+			int fd;
+			// pipes and the like are written in order, without io_uring
+			bool seekable;
+			uint64_t offset;
+			bool failed;
+
+		public:
+
+			OutputFile( const std::string& fname ) :
+				fd( open( fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 ) ),
+				seekable( is_seekable( fd ) ),
+				offset( 0 ),
+				failed( false )
+			{
+			}
+
+			~OutputFile()
+			{
+				close();
+			}
+
+			bool good() const { return fd >= 0 && !failed; }
+
+			void write( const BYTE* src, size_t len )
+			{
+				if( !good() )
+					return;
+
+				IoUring* ring = seekable ? thread_ring() : NULL;
+				if( ring == NULL || !ring->write( fd, src, len, offset ) )
+					failed = !pwrite_all( fd, seekable, src, len, offset );
+				offset += len;
+			}
+
+			//----------------------------------------
+			//  Syncs according to sync_policy(). Returns false if anything went wrong since it was opened.
+			//----------------------------------------
+			bool close()
+			{
+				if( good() && sync_policy() == SYNC_DATA && fdatasync( fd ) != 0 )
+					failed = true;
+				else if( good() && sync_policy() == SYNC_FULL && fsync( fd ) != 0 )
+					failed = true;
+				if( fd >= 0 && ::close( fd ) != 0 )
+					failed = true;
+				bool ok = fd >= 0 && !failed;
+				fd = -1;
+				failed = true;
+				return ok;
+			}
+	};
+
+	//----------------------------------------
+	//  Replaces bytes with the whole file, read to the end whatever its size says. Returns false if it can't be read.
+	//----------------------------------------
+	inline bool read_file( const std::string& fname, std::vector<BYTE>& bytes )
+	{
+		PROFILE_SCOPE( "file_io::read_file" );
+		InputFile fin( fname );
+		if( !fin.good() )
+			return false;
+
+		// room for a byte more than the size says, so a file that's all there is done in one read
+		bytes.resize( std::max( fin.remaining() + 1, MIN_READ_SIZE ) );
+		size_t len = 0;
+		while( true )
+		{
+			size_t got = fin.read( &bytes[len], bytes.size() - len );
+			len += got;
+			if( len < bytes.size() || !fin.good() )
+				break;
+			bytes.resize( 2*bytes.size() );
+		}
+		bytes.resize( len );
+		return fin.good();
+	}
+
+	//----------------------------------------
+	//  Writes len bytes as the whole file. Returns false if it can't be written.
+	//----------------------------------------
+	inline bool write_file( const std::string& fname, const BYTE* bytes, size_t len )
+	{
+		PROFILE_SCOPE( "file_io::write_file" );
+		OutputFile fout( fname );
+		fout.write( bytes, len );
+		return fout.close();
+	}
+
+	//----------------------------------------
+	//  0 if it can't be found
+	//----------------------------------------
+	inline size_t file_size( const std::string& path )
+	{
+		struct stat st;
+		return stat( path.c_str(), &st ) == 0 ? st.st_size : 0;
+	}
+
+	//----------------------------------------
+	//  Whether the two paths are the same file, however they're spelled. False if either can't be found.
+	//----------------------------------------
+	inline bool same_file( const std::string& path1, const std::string& path2 )
+	{
+		struct stat st1, st2;
+		return stat( path1.c_str(), &st1 ) == 0 && stat( path2.c_str(), &st2 ) == 0 &&
+			st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+	}
+
+	inline bool is_directory( const std::string& path )
+	{
+		struct stat st;
+		return stat( path.c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+	}
+
+	//----------------------------------------
+	//  Appends all the regular files under dir (recursively) to files, in sorted order within each directory
+	//----------------------------------------
+	inline bool list_files( const std::string& dir, std::vector<std::string>& files )
+	{
+		DIR* d = opendir( dir.c_str() );
+		if( d == NULL )
+			return false;
+
+		std::vector<std::string> names;
+		while( struct dirent* entry = readdir( d ) )
+		{
+			std::string name( entry->d_name );
+			if( name != "." && name != ".." )
+				names.push_back( name );
+		}
+		closedir( d );
+		std::sort( names.begin(), names.end() );
+
+		bool ok = true;
+		for( size_t n = 0; n < names.size(); n++ )
+		{
+			std::string path = dir + "/" + names[n];
+			struct stat st;
+			if( lstat( path.c_str(), &st ) != 0 )
+				ok = false;
+			else if( S_ISDIR( st.st_mode ) )
+				ok = list_files( path, files ) && ok;
+			else if( S_ISREG( st.st_mode ) )
+				files.push_back( path );
+		}
+		return ok;
+	}
+}
+
+#endif /* end of include guard: __FILEIO_HEADER_GUARD__ */
@@ -0,0 +1,216 @@
+//----------------------------------------
+//  The grouped flag block format (container::BLOCK_FLAGS): the bit format's commands, with their flag bits
+//	pulled out and packed ahead of them.
+//	A block is a run of groups, each a 32-bit LE flag word and then the GROUP_SIZE commands it covers.
+//	Bit k of the word is 1 if command k is a copy:
+//
+//	literal:  the byte
+//	copy:     length - MIN_MATCH (1 byte, 255 meaning more follows as in the token format),
+//	          then the delta (token_format::offset_bytes( window_bits ) bytes LE, 0 a run of the previous byte)
+//
+//	The last group stops where the block's bytes run out, and the rest of its flag bits are 0.
+//	The decoder holds a whole word of flags at once: a run of 0 bits is a run of literals, copied in one go,
+//	and a copy is a handful of byte loads. The literals stay one byte each, so it's close to the bit format's
+//	size where the token format loses most, on data with lots of lone literals between copies.
+//----------------------------------------
+
+#ifndef __FLAGFORMAT_HEADER_GUARD__
+#define __FLAGFORMAT_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Container.hpp"
+#include "TokenFormat.hpp"
+
+namespace flag_format
+{
+	// commands per flag word
+	static const int GROUP_SIZE = 32;
+	// with 2 byte deltas, a copy of 3 (25 bits) is already smaller than 3 literals (27)
+	static const unsigned int MIN_MATCH = 3;
+	static const unsigned int LEN_MAX = 255;
+
+	//----------------------------------------
+	//  Where compress_block() sends its commands for a BLOCK_FLAGS block
+	//----------------------------------------
+	class Emitter
+	{
+		private:
+
+			std::vector<BYTE> data;
+			unsigned int num_offset_bytes;
+			// where the current group's flag word is, and how many commands it has so far
+			size_t flags_pos;
+			int group_len;
+
+			//----------------------------------------
+			//  Counts in another command, starting a new group if the last is full.
+			//	Sets its flag if it's a copy (they start 0).
+			//----------------------------------------
+			void add_command( bool is_copy )
+			{
+				if( group_len == GROUP_SIZE )
+				{
+					flags_pos = data.size();
+					data.insert( data.end(), 4, 0 );
+					group_len = 0;
+				}
+				if( is_copy )
+					data[flags_pos + group_len/8] |= 1 << (group_len%8);
+				group_len++;
+			}
+
+		public:
+
+			static const container::BlockType BLOCK_TYPE = container::BLOCK_FLAGS;
+
+			Emitter( unsigned int window_bits ) :
+				num_offset_bytes( token_format::offset_bytes( window_bits ) ),
+				flags_pos( 0 ),
+				group_len( GROUP_SIZE )
+			{
+			}
+
+			//----------------------------------------
+			//  A literal costs its flag and a byte; a copy its flag, a length byte and the delta
+			//----------------------------------------
+			bool copy_pays( unsigned int delta, unsigned int len ) const
+			{
+				return len >= MIN_MATCH && copy_saving( delta, len ) > 0;
+			}
+
+			int copy_saving( unsigned int /*delta*/, unsigned int len ) const
+			{
+				return 9 * (int)len - (1 + 8 * (1 + (int)num_offset_bytes));
+			}
+
+			void literals( const BYTE* p, int n )
+			{
+				for( int j = 0; j < n; j++ )
+				{
+					add_command( false );
+					data.push_back( p[j] );
+				}
+			}
+
+			void copy( unsigned int delta, unsigned int len )
+			{
+				add_command( true );
+				unsigned int extra = len - MIN_MATCH;
+				data.push_back( std::min( extra, LEN_MAX ) );
+				if( extra >= LEN_MAX )
+					token_format::write_extra_len( data, extra - LEN_MAX );
+				for( unsigned int b = 0; b < num_offset_bytes; b++ )
+					data.push_back( (delta >> (8*b)) & 0xff );
+			}
+
+			void clear()
+			{
+				data.clear();
+				group_len = GROUP_SIZE;
+			}
+
+			//----------------------------------------
+			//  The block's payload, good until the next clear()
+			//----------------------------------------
+			const std::vector<BYTE>& finish() { return data; }
+	};
+
+	//----------------------------------------
+	//  Decodes the len bytes of groups at p onto the end of out, which should come to out_end bytes.
+	//	window_bits is what the deltas were written with. Returns false if they're corrupt. Either way out is cut
+	//	back to what was decoded.
+	//----------------------------------------
+	inline bool decode( const BYTE* p, size_t len, std::vector<BYTE>& out, size_t out_end, unsigned int window_bits )
+	{
+		const BYTE* end = p + len;
+		unsigned int num_offset_bytes = token_format::offset_bytes( window_bits );
+		const size_t CHUNK = token_format::CHUNK;
+
+		// write straight into the space the block will fill
+		size_t pos = out.size();
+		out.resize( out_end );
+		BYTE* base = out.data();
+
+		bool corrupt = false;
+		while( pos < out_end && !corrupt )
+		{
+			if( end - p < 4 )
+			{
+				corrupt = true;
+				break;
+			}
+			// 64 bits, so shifting out all 32 flags at once is fine
+			uint64_t flags = container::read_u32( p );
+			p += 4;
+
+			int left = GROUP_SIZE;
+			while( left > 0 && pos < out_end )
+			{
+				if( !(flags & 1) )
+				{
+					// literals up to the next copy, or the end of the group
+					size_t run = flags ? __builtin_ctzll( flags ) : left;
+					run = std::min( run, out_end - pos );
+					if( run > (size_t)(end - p) )
+					{
+						corrupt = true;
+						break;
+					}
+					if( (size_t)(end - p) >= 4*CHUNK && out_end - pos >= 4*CHUNK )
+						// a fixed size copy is a few moves instead of a call. What it runs over gets written again later.
+						memcpy( base + pos, p, 4*CHUNK );
+					else
+						memcpy( base + pos, p, run );
+					p += run;
+					pos += run;
+					flags >>= run;
+					left -= run;
+					continue;
+				}
+
+				size_t copy_len = MIN_MATCH;
+				if( p >= end )
+				{
+					corrupt = true;
+					break;
+				}
+				BYTE len_byte = *p++;
+				copy_len += len_byte;
+				if( len_byte == LEN_MAX && !token_format::read_extra_len( p, end, copy_len ) )
+				{
+					corrupt = true;
+					break;
+				}
+
+				if( (size_t)(end - p) < num_offset_bytes )
+				{
+					corrupt = true;
+					break;
+				}
+				size_t delta = 0;
+				for( unsigned int b = 0; b < num_offset_bytes; b++ )
+					delta |= (size_t)p[b] << (8*b);
+				p += num_offset_bytes;
+
+				if( delta >= pos || copy_len > out_end - pos )
+				{
+					corrupt = true;
+					break;
+				}
+				token_format::copy_match( base, pos, delta, copy_len, out_end );
+				pos += copy_len;
+				flags >>= 1;
+				left--;
+			}
+		}
+
+		out.resize( pos );
+		return !corrupt && p == end;
+	}
+}
+
+#endif /* end of include guard: __FLAGFORMAT_HEADER_GUARD__ */
@@ -0,0 +1,129 @@
+//----------------------------------------
+//  Single-probe hash table match finder, in the style of LZ4's fast mode.
+//	Each slot holds just the last position whose first MIN_LEN bytes hashed there: no chains and no tree,
+//	so a lookup is one multiply, one load and one compare. Anything older, or that collided, is simply lost,
+//	which costs ratio but keeps the table small enough (1 << TABLE_BITS ints) to stay in cache.
+//	Drop-in for SuffixTree: add_next_letter() and find_longest_match_after() behave the same way.
+//----------------------------------------
+
+#ifndef __HASHTABLE_HEADER_GUARD__
+#define __HASHTABLE_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+#include "MatchLength.hpp"
+
+class HashTable
+{
+	public:
+
+		// how many bytes are hashed, and so the shortest match it finds
+		enum { MIN_LEN = 4 };
+		enum { TABLE_BITS = 16 };
+
+	private:
+
+		const std::vector<BYTE>& chars;
+		int max_search_len;
+		int window;
+		std::vector<int> table;
+		int curr_i;
+
+		static uint32_t load32( const BYTE* p )
+		{
+			uint32_t x;
+			memcpy( &x, p, sizeof(x) );
+			return x;
+		}
+
+	public:
+
+		HashTable( const std::vector<BYTE>& _chars, int _max_search_len, int _window ) :
+			chars( _chars ),
+			max_search_len( _max_search_len ),
+			window( _window ),
+			table( 1 << TABLE_BITS, -1 ),
+			curr_i( 0 )
+		{
+		}
+
+		int get_curr_i() const { return curr_i; }
+
+		//----------------------------------------
+		//  Which slot the MIN_LEN bytes at p go in (Knuth's multiplicative hash)
+		//----------------------------------------
+		static uint32_t hash( const BYTE* p )
+		{
+			return (load32( p ) * 2654435761u) >> (32 - TABLE_BITS);
+		}
+
+		//----------------------------------------
+		//  Indexes the current position and moves on. Returns false at the end.
+		//----------------------------------------
+		bool add_next_letter()
+		{
+			if( curr_i >= (int)chars.size() )
+				return false;
+			if( curr_i + MIN_LEN <= (int)chars.size() )
+				table[ hash( &chars[curr_i] ) ] = curr_i;
+			curr_i++;
+			return true;
+		}
+
+		//----------------------------------------
+		//  Moves past n positions, only indexing the one nearest the end that can be
+		//----------------------------------------
+		void skip_letters( int n )
+		{
+			curr_i += n;
+			int last = std::min( curr_i - 1, (int)chars.size() - MIN_LEN );
+			if( n > 0 && last >= curr_i - n )
+				table[ hash( &chars[last] ) ] = last;
+		}
+
+		//----------------------------------------
+		//  The hot path: the one candidate for the current position, if it's within the window and really
+		//	does start with the same MIN_LEN bytes. The current position takes its slot, and we move on past it.
+		//	Returns -1 if there's no match.
+		//----------------------------------------
+		int exchange()
+		{
+			int cur = curr_i++;
+			if( cur + MIN_LEN > (int)chars.size() )
+				return -1;
+			int& slot = table[ hash( &chars[cur] ) ];
+			int cand = slot;
+			slot = cur;
+			if( cand < 0 || cur - cand > window || load32( &chars[cand] ) != load32( &chars[cur] ) )
+				return -1;
+			return cand;
+		}
+
+		//----------------------------------------
+		//  The match for target (the bytes at the current position) from the table, if it starts at or after min_pos.
+		//	rv.first = position, rv.second = length, or (-1, 0) if there isn't one.
+		//----------------------------------------
+		std::pair<int,int> find_longest_match_after( const std::vector<BYTE>& target, int min_pos, size_t* num_steps = NULL )
+		{
+			if( num_steps != NULL )
+				(*num_steps)++;
+			int len_limit = std::min( (int)target.size(), max_search_len );
+			if( len_limit < MIN_LEN )
+				return std::make_pair( -1, 0 );
+
+			int cand = table[ hash( &target[0] ) ];
+			if( cand < 0 || cand < min_pos || curr_i - cand > window )
+				return std::make_pair( -1, 0 );
+
+			int len = match_length( &chars[cand], &target[0], len_limit );
+			if( len < MIN_LEN )
+				return std::make_pair( -1, 0 );
+			return std::make_pair( cand, len );
+		}
+};
+
+#endif /* end of include guard: __HASHTABLE_HEADER_GUARD__ */
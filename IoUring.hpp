@@ -0,0 +1,322 @@
+//----------------------------------------
+//  A small io_uring, for reading and writing big stretches of a file with several requests in flight at once.
+//	It's driven with the raw system calls (there's no liburing here): requests go on the submission ring, one
+//	io_uring_enter both hands them over and waits for the first to finish, and results come back on the completion
+//	ring, so a whole queue of reads costs a system call or two instead of one each.
+//	Requests go through QUEUE_DEPTH staging buffers registered with the kernel up front, so it doesn't have to pin
+//	the pages for every request. If it won't register them (eg. a low RLIMIT_MEMLOCK) requests go straight to the
+//	caller's memory instead.
+//	Where the kernel or headers have no io_uring, ok() is just false and callers use plain reads and writes.
+//----------------------------------------
+
+#ifndef __IOURING_HEADER_GUARD__
+#define __IOURING_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#include "MatchLength.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ALZ_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef ALZ_HAVE_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// linux/fs.h comes with io_uring.h, and its macros would clobber container::BLOCK_SIZE
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+
+class IoUring
+{
+	public:
+
+		static const int QUEUE_DEPTH = 8;
+		static const size_t BUFFER_SIZE = 256 << 10;
+
+	private:
+
+		int ring_fd;
+
+		// the submission ring
+		void* sq_map;
+		size_t sq_map_len;
+		unsigned* sq_tail;
+		unsigned* sq_mask;
+		unsigned* sq_array;
+		io_uring_sqe* sqes;
+		size_t sqes_len;
+		unsigned to_submit;
+
+		// the completion ring, which may share sq_map
+		void* cq_map;
+		size_t cq_map_len;
+		unsigned* cq_head;
+		unsigned* cq_tail;
+		unsigned* cq_mask;
+		io_uring_cqe* cqes;
+
+		// QUEUE_DEPTH registered buffers of BUFFER_SIZE, if fixed
+		std::vector<BYTE> buffers;
+		bool fixed;
+
+		//----------------------------------------
+		//  A request in flight, for a stretch of the caller's memory. user_data is its index.
+		//----------------------------------------
+		struct Slot
+		{
+			size_t pos;
+			size_t len;
+			// how much of it's been read or written so far
+			size_t done;
+		};
+
+		BYTE* buffer( int slot ) { return &buffers[slot * BUFFER_SIZE]; }
+
+		void queue( int op, int fd, BYTE* addr, size_t len, uint64_t offset, int slot )
+		{
+			unsigned tail = *sq_tail;
+			unsigned index = tail & *sq_mask;
+			io_uring_sqe& sqe = sqes[index];
+			memset( &sqe, 0, sizeof(sqe) );
+			sqe.opcode = op;
+			sqe.fd = fd;
+			sqe.addr = (uint64_t)(uintptr_t)addr;
+			sqe.len = len;
+			sqe.off = offset;
+			sqe.buf_index = fixed ? slot : 0;
+			sqe.user_data = slot;
+			sq_array[index] = index;
+			// the kernel mustn't see the new tail before the entry it covers
+			__atomic_store_n( sq_tail, tail+1, __ATOMIC_RELEASE );
+			to_submit++;
+		}
+
+		//----------------------------------------
+		//  Submits what's queued and waits for at least one completion
+		//----------------------------------------
+		bool submit_and_wait()
+		{
+			while( true )
+			{
+				int ret = syscall( __NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+				if( ret >= 0 )
+				{
+					to_submit -= std::min( (unsigned)ret, to_submit );
+					return true;
+				}
+				if( errno != EINTR )
+					return false;
+			}
+		}
+
+		//----------------------------------------
+		//  Runs a read or write of len bytes at offset through the ring, QUEUE_DEPTH requests at a time.
+		//	A short request is requeued for the rest. A read that gets nothing has hit the end of the file,
+		//	and got says how far the data goes. Returns false on an error.
+		//----------------------------------------
+		bool run( bool reading, int fd, BYTE* data, size_t len, uint64_t offset, size_t& got )
+		{
+			int op = reading ? (fixed ? IORING_OP_READ_FIXED : IORING_OP_READ) : (fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+			Slot slots[QUEUE_DEPTH];
+			int free_slots[QUEUE_DEPTH];
+			int num_free = QUEUE_DEPTH;
+			for( int s = 0; s < QUEUE_DEPTH; s++ )
+				free_slots[s] = QUEUE_DEPTH-1 - s;
+
+			size_t next = 0;
+			size_t end = len;
+			int in_flight = 0;
+			bool failed = false;
+			while( true )
+			{
+				while( !failed && num_free > 0 && next < end )
+				{
+					int s = free_slots[--num_free];
+					slots[s].pos = next;
+					slots[s].len = std::min( (size_t)BUFFER_SIZE, end - next );
+					slots[s].done = 0;
+					if( fixed && !reading )
+						memcpy( buffer( s ), data + next, slots[s].len );
+					queue( op, fd, fixed ? buffer( s ) : data + next, slots[s].len, offset + next, s );
+					next += slots[s].len;
+					in_flight++;
+				}
+				if( in_flight == 0 )
+					break;
+
+				if( !submit_and_wait() )
+				{
+					// we can't tell what's still in flight, so close the ring down, which cancels it all
+					release();
+					return false;
+				}
+
+				unsigned head = *cq_head;
+				unsigned tail = __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE );
+				for( ; head != tail; head++ )
+				{
+					const io_uring_cqe& cqe = cqes[head & *cq_mask];
+					int s = cqe.user_data;
+					Slot& slot = slots[s];
+					int res = cqe.res;
+					in_flight--;
+
+					if( res == -EAGAIN || res == -EINTR )
+						// try again
+						res = 0;
+					else if( res < 0 || (res == 0 && !reading) )
+						failed = true;
+					else if( res == 0 )
+						// the end of the file
+						end = std::min( end, slot.pos + slot.done );
+
+					if( res > 0 )
+					{
+						if( fixed && reading )
+							memcpy( data + slot.pos + slot.done, buffer( s ) + slot.done, res );
+						slot.done += res;
+					}
+
+					if( !failed && slot.done < slot.len && slot.pos + slot.done < end )
+					{
+						// short, so ask for the rest
+						BYTE* addr = fixed ? buffer( s ) + slot.done : data + slot.pos + slot.done;
+						queue( op, fd, addr, slot.len - slot.done, offset + slot.pos + slot.done, s );
+						in_flight++;
+					}
+					else
+						free_slots[num_free++] = s;
+				}
+				__atomic_store_n( cq_head, head, __ATOMIC_RELEASE );
+			}
+
+			got = end;
+			return !failed;
+		}
+
+	public:
+
+		IoUring() :
+			ring_fd( -1 ),
+			sq_map( MAP_FAILED ),
+			sqes( (io_uring_sqe*)MAP_FAILED ),
+			to_submit( 0 ),
+			cq_map( MAP_FAILED ),
+			fixed( false )
+		{
+			io_uring_params p;
+			memset( &p, 0, sizeof(p) );
+			ring_fd = syscall( __NR_io_uring_setup, QUEUE_DEPTH, &p );
+			if( ring_fd < 0 )
+				return;
+
+			sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			bool single_map = p.features & IORING_FEAT_SINGLE_MMAP;
+			if( single_map )
+				sq_map_len = cq_map_len = std::max( sq_map_len, cq_map_len );
+			sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+
+			sq_map = mmap( NULL, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING );
+			cq_map = single_map ? sq_map : mmap( NULL, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING );
+			sqes = (io_uring_sqe*)mmap( NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES );
+			if( sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqes == MAP_FAILED )
+			{
+				release();
+				return;
+			}
+
+			BYTE* sq = (BYTE*)sq_map;
+			sq_tail = (unsigned*)(sq + p.sq_off.tail);
+			sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+			sq_array = (unsigned*)(sq + p.sq_off.array);
+			BYTE* cq = (BYTE*)cq_map;
+			cq_head = (unsigned*)(cq + p.cq_off.head);
+			cq_tail = (unsigned*)(cq + p.cq_off.tail);
+			cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+			cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+			buffers.resize( QUEUE_DEPTH * BUFFER_SIZE );
+			iovec iov[QUEUE_DEPTH];
+			for( int s = 0; s < QUEUE_DEPTH; s++ )
+			{
+				iov[s].iov_base = buffer( s );
+				iov[s].iov_len = BUFFER_SIZE;
+			}
+			fixed = syscall( __NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, QUEUE_DEPTH ) == 0;
+			if( !fixed )
+				std::vector<BYTE>().swap( buffers );
+		}
+
+		~IoUring()
+		{
+			release();
+		}
+
+		bool ok() const { return ring_fd >= 0; }
+
+		//----------------------------------------
+		//  Reads up to len bytes from offset in fd. got is set to how many, which is less only at the end of the file.
+		//	Returns false on an error.
+		//----------------------------------------
+		bool read( int fd, BYTE* dst, size_t len, uint64_t offset, size_t& got )
+		{
+			return run( true, fd, dst, len, offset, got );
+		}
+
+		//----------------------------------------
+		//  Writes all len bytes at offset in fd. Returns false on an error.
+		//----------------------------------------
+		bool write( int fd, const BYTE* src, size_t len, uint64_t offset )
+		{
+			size_t done;
+			return run( false, fd, (BYTE*)src, len, offset, done );
+		}
+
+	private:
+
+		void release()
+		{
+			if( sqes != MAP_FAILED )
+				munmap( sqes, sqes_len );
+			if( cq_map != MAP_FAILED && cq_map != sq_map )
+				munmap( cq_map, cq_map_len );
+			if( sq_map != MAP_FAILED )
+				munmap( sq_map, sq_map_len );
+			sqes = (io_uring_sqe*)MAP_FAILED;
+			cq_map = sq_map = MAP_FAILED;
+			if( ring_fd >= 0 )
+				close( ring_fd );
+			ring_fd = -1;
+		}
+};
+
+#else
+
+//----------------------------------------
+//  No io_uring to be had, so never ok()
+//----------------------------------------
+class IoUring
+{
+	public:
+
+		bool ok() const { return false; }
+		bool read( int fd, BYTE* dst, size_t len, uint64_t offset, size_t& got ) { return false; }
+		bool write( int fd, const BYTE* src, size_t len, uint64_t offset ) { return false; }
+};
+
+#endif
+
+#endif /* end of include guard: __IOURING_HEADER_GUARD__ */
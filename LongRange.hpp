@@ -0,0 +1,142 @@
+//----------------------------------------
+//  Long distance matching: a pre-pass over the whole input that finds long repeats too far apart for the window.
+//	A rolling hash runs over every ANCHOR_LEN-byte stretch, and the stretches whose hash has its top ANCHOR_BITS
+//	bits clear are anchors. Which stretches those are depends only on their content, so a repeated region has
+//	its anchors in the same places both times, and only about one position in 2^ANCHOR_BITS touches the table.
+//	A candidate from the table is checked byte for byte, then extended both ways as far as it goes.
+//----------------------------------------
+
+#ifndef __LONGRANGE_HEADER_GUARD__
+#define __LONGRANGE_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#include "MatchLength.hpp"
+#include "Profile.hpp"
+
+namespace long_range
+{
+	static const int ANCHOR_LEN = 64;
+	static const int ANCHOR_BITS = 5;
+	// shorter than this isn't worth splitting the blocks around it for
+	static const int MIN_LEN = 256;
+
+	static const uint64_t HASH_MULT = 0x100000001b3ULL;
+
+	struct LongMatch
+	{
+		// copies len bytes from src to pos
+		int pos;
+		int src;
+		int len;
+	};
+
+	//----------------------------------------
+	//  Polynomial hash of the last ANCHOR_LEN bytes, updated a byte at a time
+	//----------------------------------------
+	class RollingHash
+	{
+		private:
+
+			uint64_t hash;
+			// HASH_MULT^ANCHOR_LEN, what the byte leaving the window was multiplied by
+			uint64_t out_mult;
+
+		public:
+
+			RollingHash() :
+				hash( 0 ),
+				out_mult( 1 )
+			{
+				for( int k = 0; k < ANCHOR_LEN; k++ )
+					out_mult *= HASH_MULT;
+			}
+
+			void reset( const BYTE* p )
+			{
+				hash = 0;
+				for( int k = 0; k < ANCHOR_LEN; k++ )
+					hash = hash * HASH_MULT + p[k];
+			}
+
+			void roll( BYTE out, BYTE in )
+			{
+				hash = hash * HASH_MULT + in - out * out_mult;
+			}
+
+			// the low bits only depend on the bytes' low bits, so look at the top ones
+			bool is_anchor() const { return (hash >> (64 - ANCHOR_BITS)) == 0; }
+
+			size_t slot( int table_bits ) const { return (size_t)((hash * 0x9e3779b97f4a7c15ULL) >> (64 - table_bits)); }
+	};
+
+	//----------------------------------------
+	//  Fills matches with non-overlapping long repeats in bytes, in order, whose source is more than min_distance back.
+	//	Only repeats from start on are reported, but the bytes before it can be their sources.
+	//----------------------------------------
+	inline void find_long_matches( const std::vector<BYTE>& bytes, int start, int min_distance, std::vector<LongMatch>& matches )
+	{
+		PROFILE_SCOPE( "long_range::find_long_matches" );
+		matches.clear();
+		int n = bytes.size();
+		if( n < MIN_LEN )
+			return;
+
+		// about one anchor per table entry
+		int table_bits = 10;
+		while( table_bits < 30 && ((size_t)1 << table_bits) < (size_t)(n >> ANCHOR_BITS) )
+			table_bits++;
+		std::vector<int> table( (size_t)1 << table_bits, -1 );
+
+		RollingHash rh;
+		rh.reset( &bytes[0] );
+		int last_end = start;
+
+		// rh covers [i, i+ANCHOR_LEN)
+		for( int i = 0; ; )
+		{
+			if( rh.is_anchor() )
+			{
+				int& entry = table[ rh.slot( table_bits ) ];
+				int cand = entry;
+				entry = i;
+
+				if( cand >= 0 && i >= start && i - cand > min_distance && memcmp( &bytes[cand], &bytes[i], ANCHOR_LEN ) == 0 )
+				{
+					int len = ANCHOR_LEN + match_length( &bytes[cand+ANCHOR_LEN], &bytes[i+ANCHOR_LEN], n-i-ANCHOR_LEN );
+					int pos = i;
+					int src = cand;
+					while( pos > last_end && src > 0 && bytes[pos-1] == bytes[src-1] )
+					{
+						pos--;
+						src--;
+						len++;
+					}
+
+					if( len >= MIN_LEN )
+					{
+						LongMatch m = { pos, src, len };
+						matches.push_back( m );
+						last_end = pos + len;
+
+						// carry on after it
+						i = last_end;
+						if( i + ANCHOR_LEN > n )
+							break;
+						rh.reset( &bytes[i] );
+						continue;
+					}
+				}
+			}
+
+			if( i + ANCHOR_LEN >= n )
+				break;
+			rh.roll( bytes[i], bytes[i+ANCHOR_LEN] );
+			i++;
+		}
+	}
+}
+
+#endif /* end of include guard: __LONGRANGE_HEADER_GUARD__ */
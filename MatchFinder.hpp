@@ -0,0 +1,475 @@
+//----------------------------------------
+//  The match finders, and the options for driving them. A finder walks through the input once: find_best() and
+//	find_all() look for matches for the bytes at the current position, and advance() moves past positions,
+//	indexing them as history.
+//	compress_block() is a template over the finder, so they don't share a base class, just the same members
+//	(see BruteForceFinder), and the calls in the hot loop are direct and get inlined.
+//----------------------------------------
+
+#ifndef __MATCHFINDER_HEADER_GUARD__
+#define __MATCHFINDER_HEADER_GUARD__
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+
+#include "SuffixTree.hpp"
+#include "BinaryTree.hpp"
+#include "SuffixArray.hpp"
+#include "BruteForce.hpp"
+#include "HashTable.hpp"
+#include "Stats.hpp"
+#include "Container.hpp"
+
+//----------------------------------------
+//  Which match finder to use
+//----------------------------------------
+enum MatchEngine
+{
+	ENGINE_BRUTE_FORCE,
+	ENGINE_SUFFIX_TREE,
+	ENGINE_BINARY_TREE,
+	ENGINE_SUFFIX_ARRAY,
+	ENGINE_HASH_TABLE,
+	NUM_ENGINES
+};
+
+//----------------------------------------
+//  How a compressed block's commands are written out
+//----------------------------------------
+enum BlockFormat
+{
+	// flag bits and bit-packed fields (container::BLOCK_BITS): the smallest
+	FORMAT_BITS,
+	// byte-aligned tokens (container::BLOCK_TOKENS, see TokenFormat.hpp): bigger, but much faster to decode
+	FORMAT_TOKENS,
+	// byte-aligned commands with flag words (container::BLOCK_FLAGS, see FlagFormat.hpp): in between
+	FORMAT_FLAGS,
+	// tokens split into streams decoded side by side (container::BLOCK_STREAMS, see StreamFormat.hpp)
+	FORMAT_STREAMS,
+	NUM_FORMATS
+};
+
+//----------------------------------------
+//  Everything that controls how compress_main goes about it
+//----------------------------------------
+struct CompressOptions
+{
+	MatchEngine engine;
+
+	// Skip work where it's unlikely to pay: only index some of the positions inside copies (if the finder
+	// allows it), and search less and less often through runs of literals. Any match resets the skipping.
+	bool fast;
+
+	// copies reach back up to 2^window_bits bytes, and the delta field is this many bits wide
+	int window_bits;
+
+	// Look for long repeats beyond the window over the whole input first, and code them as container copy blocks
+	bool long_range;
+
+	// if not empty, a dictionary file whose bytes are treated as history before the input
+	std::string dict_file;
+
+	// dict_file is a reference file, eg. an older version of the input, so the input is coded as a delta against it.
+	// The window grows to reach all of it, and long repeats are looked for too.
+	bool reference;
+
+	// how many threads to compress with. It doesn't change the output.
+	int num_threads;
+
+	// How many candidates the binary tree finder looks at per position before giving up, or 0 for its default.
+	// The others don't have a limit.
+	int search_depth;
+
+	// Lazy parsing: before taking a copy, see whether the next position has a better one, and if so
+	// make this byte a literal instead
+	bool lazy;
+
+	// what the compressed blocks are written as
+	BlockFormat format;
+
+	CompressOptions() :
+		engine( ENGINE_SUFFIX_TREE ),
+		fast( false ),
+		window_bits( container::DEFAULT_WINDOW_BITS ),
+		long_range( false ),
+		reference( false ),
+		num_threads( 1 ),
+		search_depth( 0 ),
+		lazy( false ),
+		format( FORMAT_BITS )
+	{
+	}
+};
+
+//----------------------------------------
+//  Compression levels, -1 (fastest) to -9 (smallest), as presets of the options above.
+//	Lazy parsing is nearly free and worth a few percent, and search depth and fast mode trade the rest.
+//	-1 and -2 use the hash table, which is in a different league for speed, and write the token format, which
+//	decodes 2-3x faster. On binary data like displace.bin it's smaller too, but on text it's 10% or so bigger,
+//	so the levels after them, which are there for size, keep the bit stream.
+//	The window stays at 2^16: on the inputs here a wider one finds little more, and its far copies cost more bits.
+//	Big inputs with distant repeats do better with -w 20 after the level, and -9 looks for long repeats anyway.
+//	On work/displace.bin followed by config.sub (735KB), one thread, built with -O2, as `make bench_levels` runs it:
+//
+//		level	ratio	ms			level	ratio	ms
+//		-1		1.598	15			-6		1.669	138
+//		-2		1.648	16			-7		1.670	157
+//		-3		1.655	86			-8		1.671	159
+//		-4		1.658	97			-9		1.671	154
+//		-5		1.665	110
+//
+//	(the default, -m st, is 1.594 in 2600ms).
+//----------------------------------------
+static const int MIN_LEVEL = 1;
+static const int MAX_LEVEL = 9;
+
+inline void apply_level( int level, CompressOptions& opts )
+{
+	struct Preset
+	{
+		MatchEngine engine;
+		bool fast;
+		int search_depth;
+		bool lazy;
+		int window_bits;
+		bool long_range;
+		BlockFormat format;
+	};
+	static const Preset presets[MAX_LEVEL] =
+	{
+		//	engine					fast	depth	lazy	window	long	format
+		{ ENGINE_HASH_TABLE,	true,	0,		false,	14,		false,	FORMAT_TOKENS },
+		{ ENGINE_HASH_TABLE,	false,	0,		false,	16,		false,	FORMAT_TOKENS },
+		{ ENGINE_BINARY_TREE,	true,	16,		true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	true,	32,		true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	false,	12,		true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	false,	16,		true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	false,	32,		true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	false,	256,	true,	16,		false,	FORMAT_BITS },
+		{ ENGINE_BINARY_TREE,	false,	256,	true,	16,		true,	FORMAT_BITS },
+	};
+
+	const Preset& p = presets[ std::max( MIN_LEVEL, std::min( level, MAX_LEVEL ) ) - MIN_LEVEL ];
+	opts.engine = p.engine;
+	opts.fast = p.fast;
+	opts.search_depth = p.search_depth;
+	opts.lazy = p.lazy;
+	opts.window_bits = p.window_bits;
+	opts.long_range = p.long_range;
+	opts.format = p.format;
+}
+
+inline const char* engine_name( MatchEngine engine )
+{
+	static const char* names[NUM_ENGINES] = { "bf", "st", "bt", "sa", "ht" };
+	return names[engine];
+}
+
+//----------------------------------------
+//  Returns false if the name isn't one of engine_name()'s
+//----------------------------------------
+inline bool parse_engine( const std::string& name, MatchEngine& engine )
+{
+	for( int e = 0; e < NUM_ENGINES; e++ )
+	{
+		if( name == engine_name( (MatchEngine)e ) )
+		{
+			engine = (MatchEngine)e;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline const char* format_name( BlockFormat format )
+{
+	static const char* names[NUM_FORMATS] = { "bits", "tokens", "flags", "streams" };
+	return names[format];
+}
+
+//----------------------------------------
+//  Returns false if the name isn't one of format_name()'s
+//----------------------------------------
+inline bool parse_format( const std::string& name, BlockFormat& format )
+{
+	for( int f = 0; f < NUM_FORMATS; f++ )
+	{
+		if( name == format_name( (BlockFormat)f ) )
+		{
+			format = (BlockFormat)f;
+			return true;
+		}
+	}
+	return false;
+}
+
+// first = position, second = length
+typedef std::pair<int,int> Match;
+
+//----------------------------------------
+//  find_all() for finders that can only see the best match: just that, if there is one
+//----------------------------------------
+inline void best_as_all( const Match& best, std::vector<Match>& matches )
+{
+	matches.clear();
+	if( best.second > 0 )
+		matches.push_back( best );
+}
+
+//----------------------------------------
+//  The exact, slow one. Nothing to index, so advancing is free.
+//----------------------------------------
+class BruteForceFinder
+{
+	private:
+
+		const std::vector<BYTE>& chars;
+		int max_search_len;
+		int curr_i;
+
+	public:
+
+		BruteForceFinder( const std::vector<BYTE>& _chars, int _max_search_len ) :
+			chars( _chars ),
+			max_search_len( _max_search_len ),
+			curr_i( 0 )
+		{
+		}
+
+		//----------------------------------------
+		//  The longest match this finder reports, so the target needn't be any longer
+		//----------------------------------------
+		int get_max_search_len() const { return max_search_len; }
+
+		//----------------------------------------
+		//  Moves past the next n positions, adding them to the history
+		//----------------------------------------
+		void advance( int n )
+		{
+			curr_i += n;
+			assert( curr_i <= (int)chars.size() );
+		}
+
+		//----------------------------------------
+		//  Like advance(), but the finder may index only some of the positions, trading ratio for speed
+		//----------------------------------------
+		void skip( int n ) { advance( n ); }
+
+		//----------------------------------------
+		//  The longest match for target (which must be the bytes at the current position) starting at or after min_pos.
+		//	Returns (-1, 0) if there is none. If num_steps is given, the search effort is added to it.
+		//----------------------------------------
+		Match find_best( const std::vector<BYTE>& target, int min_pos, size_t* num_steps )
+		{
+			int best_len = -1;
+			int pos = find_longest_match( chars, min_pos, curr_i, target, best_len, num_steps );
+			if( best_len <= 0 )
+				return Match( -1, 0 );
+			return Match( pos, best_len );
+		}
+
+		//----------------------------------------
+		//  All the improving matches at the current position, in order of increasing length
+		//----------------------------------------
+		void find_all( const std::vector<BYTE>& target, int min_pos, std::vector<Match>& matches, size_t* num_steps )
+		{
+			best_as_all( find_best( target, min_pos, num_steps ), matches );
+		}
+
+		//----------------------------------------
+		//  Fills in whatever structure sizes this finder knows about
+		//----------------------------------------
+		void add_stats( Stats& /*stats*/ ) const {}
+};
+
+class SuffixTreeFinder
+{
+	private:
+
+		SuffixTree tree;
+		int max_search_len;
+
+	public:
+
+		SuffixTreeFinder( const std::vector<BYTE>& chars, int _max_search_len ) :
+			tree( chars, _max_search_len ),
+			max_search_len( _max_search_len )
+		{
+		}
+
+		int get_max_search_len() const { return max_search_len; }
+
+		void advance( int n )
+		{
+			for( int j = 0; j < n; j++ )
+			{
+				bool ok = tree.add_next_letter();
+				assert( ok );
+			}
+		}
+
+		void skip( int n ) { advance( n ); }
+
+		Match find_best( const std::vector<BYTE>& target, int min_pos, size_t* num_steps )
+		{
+			return tree.find_longest_match_after( target, min_pos, num_steps );
+		}
+
+		void find_all( const std::vector<BYTE>& target, int min_pos, std::vector<Match>& matches, size_t* num_steps )
+		{
+			best_as_all( find_best( target, min_pos, num_steps ), matches );
+		}
+
+		void add_stats( Stats& stats ) const
+		{
+			tree.count_nodes_edges( stats.num_nodes, stats.num_edges );
+		}
+};
+
+class BinaryTreeFinder
+{
+	private:
+
+		BinaryTree tree;
+		int max_search_len;
+
+	public:
+
+		BinaryTreeFinder( const std::vector<BYTE>& chars, int _max_search_len, int window, int max_depth = BinaryTree::DEFAULT_MAX_DEPTH ) :
+			tree( chars, _max_search_len, window, max_depth ),
+			max_search_len( _max_search_len )
+		{
+		}
+
+		int get_max_search_len() const { return max_search_len; }
+
+		void advance( int n )
+		{
+			for( int j = 0; j < n; j++ )
+			{
+				bool ok = tree.add_next_letter();
+				assert( ok );
+			}
+		}
+
+		void skip( int n )
+		{
+			tree.skip_letters( n );
+		}
+
+		Match find_best( const std::vector<BYTE>& target, int min_pos, size_t* num_steps )
+		{
+			return tree.find_longest_match_after( target, min_pos, num_steps );
+		}
+
+		void find_all( const std::vector<BYTE>& target, int min_pos, std::vector<Match>& matches, size_t* num_steps )
+		{
+			matches = tree.find_all_matches( min_pos, num_steps );
+			for( size_t m = 0; m < matches.size(); m++ )
+				matches[m].second = std::min( matches[m].second, (int)target.size() );
+		}
+
+		void add_stats( Stats& /*stats*/ ) const {}
+};
+
+class SuffixArrayFinder
+{
+	private:
+
+		SuffixArray sarray;
+		int max_search_len;
+
+	public:
+
+		SuffixArrayFinder( const std::vector<BYTE>& chars, int _max_search_len, int window ) :
+			sarray( chars, _max_search_len, window ),
+			max_search_len( _max_search_len )
+		{
+		}
+
+		int get_max_search_len() const { return max_search_len; }
+
+		void advance( int n )
+		{
+			for( int j = 0; j < n; j++ )
+			{
+				bool ok = sarray.add_next_letter();
+				assert( ok );
+			}
+		}
+
+		void skip( int n ) { advance( n ); }
+
+		Match find_best( const std::vector<BYTE>& target, int min_pos, size_t* num_steps )
+		{
+			return sarray.find_longest_match_after( target, min_pos, num_steps );
+		}
+
+		void find_all( const std::vector<BYTE>& target, int min_pos, std::vector<Match>& matches, size_t* num_steps )
+		{
+			best_as_all( find_best( target, min_pos, num_steps ), matches );
+		}
+
+		void add_stats( Stats& /*stats*/ ) const {}
+};
+
+//----------------------------------------
+//  The fastest and least thorough: one candidate per position, and skip() barely indexes anything.
+//	compress_block() has its own loop for this one, which calls exchange() directly.
+//----------------------------------------
+class HashTableFinder
+{
+	private:
+
+		HashTable table;
+		int max_search_len;
+
+	public:
+
+		HashTableFinder( const std::vector<BYTE>& chars, int _max_search_len, int window ) :
+			table( chars, _max_search_len, window ),
+			max_search_len( _max_search_len )
+		{
+		}
+
+		int get_max_search_len() const { return max_search_len; }
+
+		void advance( int n )
+		{
+			for( int j = 0; j < n; j++ )
+			{
+				bool ok = table.add_next_letter();
+				assert( ok );
+			}
+		}
+
+		void skip( int n )
+		{
+			table.skip_letters( n );
+		}
+
+		//----------------------------------------
+		//  See HashTable::exchange()
+		//----------------------------------------
+		int exchange()
+		{
+			return table.exchange();
+		}
+
+		Match find_best( const std::vector<BYTE>& target, int min_pos, size_t* num_steps )
+		{
+			return table.find_longest_match_after( target, min_pos, num_steps );
+		}
+
+		void find_all( const std::vector<BYTE>& target, int min_pos, std::vector<Match>& matches, size_t* num_steps )
+		{
+			best_as_all( find_best( target, min_pos, num_steps ), matches );
+		}
+
+		void add_stats( Stats& /*stats*/ ) const {}
+};
+
+#endif /* end of include guard: __MATCHFINDER_HEADER_GUARD__ */
@@ -0,0 +1,138 @@
+//----------------------------------------
+//  Match length extension: how many leading bytes two buffers have in common.
+//	This is the inner loop of every match finder once matches get long, so compare many bytes at a time:
+//	32 with AVX2, 16 with SSE2, or 8 with a 64-bit XOR + count-trailing-zeros everywhere else.
+//	The widest kernel the CPU supports is picked once at runtime.
+//----------------------------------------
+
+#ifndef __MATCHLENGTH_HEADER_GUARD__
+#define __MATCHLENGTH_HEADER_GUARD__
+
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ALZ_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef unsigned char BYTE;
+
+namespace match_length_impl
+{
+	inline uint64_t load64( const BYTE* p )
+	{
+		uint64_t x;
+		memcpy( &x, p, sizeof(x) );
+		return x;
+	}
+
+	//----------------------------------------
+	//  Finishes off the last few bytes, 8 then 1 at a time
+	//----------------------------------------
+	inline int tail( const BYTE* a, const BYTE* b, int len, int max_len )
+	{
+		while( len + 8 <= max_len )
+		{
+			uint64_t diff = load64( a+len ) ^ load64( b+len );
+			if( diff != 0 )
+			{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				return len + (__builtin_ctzll( diff ) >> 3);
+#else
+				return len + (__builtin_clzll( diff ) >> 3);
+#endif
+			}
+			len += 8;
+		}
+
+		while( len < max_len && a[len] == b[len] )
+			len++;
+		return len;
+	}
+
+	inline int scalar( const BYTE* a, const BYTE* b, int max_len )
+	{
+		return tail( a, b, 0, max_len );
+	}
+
+#ifdef ALZ_X86_SIMD
+	inline int sse2( const BYTE* a, const BYTE* b, int max_len )
+	{
+		int len = 0;
+		while( len + 16 <= max_len )
+		{
+			__m128i va = _mm_loadu_si128( (const __m128i*)(a+len) );
+			__m128i vb = _mm_loadu_si128( (const __m128i*)(b+len) );
+			unsigned int eq = _mm_movemask_epi8( _mm_cmpeq_epi8( va, vb ) );
+			if( eq != 0xffff )
+				return len + __builtin_ctz( ~eq );
+			len += 16;
+		}
+		return tail( a, b, len, max_len );
+	}
+
+	__attribute__((target("avx2")))
+	inline int avx2( const BYTE* a, const BYTE* b, int max_len )
+	{
+		int len = 0;
+		while( len + 32 <= max_len )
+		{
+			__m256i va = _mm256_loadu_si256( (const __m256i*)(a+len) );
+			__m256i vb = _mm256_loadu_si256( (const __m256i*)(b+len) );
+			unsigned int eq = _mm256_movemask_epi8( _mm256_cmpeq_epi8( va, vb ) );
+			if( eq != 0xffffffffu )
+				return len + __builtin_ctz( ~eq );
+			len += 32;
+		}
+		return tail( a, b, len, max_len );
+	}
+#endif
+
+	typedef int (*Kernel)( const BYTE*, const BYTE*, int );
+
+	inline Kernel pick_kernel()
+	{
+#ifdef ALZ_X86_SIMD
+		if( __builtin_cpu_supports( "avx2" ) )
+			return avx2;
+		if( __builtin_cpu_supports( "sse2" ) )
+			return sse2;
+#endif
+		return scalar;
+	}
+
+	inline Kernel kernel()
+	{
+		static const Kernel k = pick_kernel();
+		return k;
+	}
+
+	inline const char* kernel_name()
+	{
+#ifdef ALZ_X86_SIMD
+		if( kernel() == avx2 ) return "avx2";
+		if( kernel() == sse2 ) return "sse2";
+#endif
+		return "scalar";
+	}
+}
+
+//----------------------------------------
+//  Returns the number of leading bytes that a and b have in common, at most max_len.
+//	Never reads a[max_len] or b[max_len] or beyond, so max_len must respect both buffers' bounds.
+//----------------------------------------
+inline int match_length( const BYTE* a, const BYTE* b, int max_len )
+{
+	// short compares are common, and not worth the indirect call
+	if( max_len < 8 )
+	{
+		int len = 0;
+		while( len < max_len && a[len] == b[len] )
+			len++;
+		return len;
+	}
+	return match_length_impl::kernel()( a, b, max_len );
+}
+
+#endif /* end of include guard: __MATCHLENGTH_HEADER_GUARD__ */
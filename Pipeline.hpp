@@ -0,0 +1,146 @@
+//----------------------------------------
+//  The pieces for running read, compress and write as concurrent stages.
+//	BoundedQueue passes work from one stage to the next, and blocks the producer when the consumer falls behind.
+//	ReorderBuffer takes results in whatever order the workers finish them and hands them on in sequence,
+//	and limits how far ahead of the writer the rest of the pipeline can get, so memory stays bounded.
+//----------------------------------------
+
+#ifndef __PIPELINE_HEADER_GUARD__
+#define __PIPELINE_HEADER_GUARD__
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "MatchLength.hpp"
+
+template <class T>
+class BoundedQueue
+{
+	private:
+
+		size_t capacity;
+		std::deque<T> items;
+		bool closed;
+
+		std::mutex mutex;
+		std::condition_variable not_full;
+		std::condition_variable not_empty;
+
+	public:
+
+		BoundedQueue( size_t _capacity ) :
+			capacity( _capacity ),
+			closed( false )
+		{
+		}
+
+		//----------------------------------------
+		//  Waits for room, then adds item
+		//----------------------------------------
+		void push( T&& item )
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			not_full.wait( lock, [this]() { return items.size() < capacity; } );
+			items.push_back( std::move( item ) );
+			not_empty.notify_one();
+		}
+
+		//----------------------------------------
+		//  Waits for an item. Returns false once the queue is closed and empty.
+		//----------------------------------------
+		bool pop( T& item )
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			not_empty.wait( lock, [this]() { return !items.empty() || closed; } );
+			if( items.empty() )
+				return false;
+			item = std::move( items.front() );
+			items.pop_front();
+			not_full.notify_one();
+			return true;
+		}
+
+		//----------------------------------------
+		//  No more pushes after this
+		//----------------------------------------
+		void close()
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			closed = true;
+			not_empty.notify_all();
+		}
+};
+
+class ReorderBuffer
+{
+	private:
+
+		// how many results may be waiting or in progress ahead of the one to go next
+		size_t capacity;
+		size_t next_index;
+		std::map< size_t, std::vector<BYTE> > ready;
+		bool closed;
+
+		std::mutex mutex;
+		std::condition_variable room;
+		std::condition_variable arrived;
+
+	public:
+
+		ReorderBuffer( size_t _capacity ) :
+			capacity( _capacity ),
+			next_index( 0 ),
+			closed( false )
+		{
+		}
+
+		//----------------------------------------
+		//  Waits until result number index is close enough to the front to be started on
+		//----------------------------------------
+		void wait_for_room( size_t index )
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			room.wait( lock, [&]() { return index < next_index + capacity; } );
+		}
+
+		void put( size_t index, std::vector<BYTE>&& data )
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			ready[index] = std::move( data );
+			if( index == next_index )
+				arrived.notify_all();
+		}
+
+		//----------------------------------------
+		//  Waits for the next result in order. Returns false once closed and everything's been taken.
+		//----------------------------------------
+		bool take_next( std::vector<BYTE>& data )
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			arrived.wait( lock, [this]() { return ready.count( next_index ) > 0 || (closed && ready.empty()); } );
+			if( ready.empty() )
+				return false;
+
+			std::map< size_t, std::vector<BYTE> >::iterator it = ready.find( next_index );
+			data = std::move( it->second );
+			ready.erase( it );
+			next_index++;
+			room.notify_all();
+			return true;
+		}
+
+		//----------------------------------------
+		//  No more results after this
+		//----------------------------------------
+		void close()
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			closed = true;
+			arrived.notify_all();
+		}
+};
+
+#endif /* end of include guard: __PIPELINE_HEADER_GUARD__ */
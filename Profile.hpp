@@ -0,0 +1,311 @@
+//----------------------------------------
+//  Optional per-phase profiling: scoped wall-clock timers, plus Linux hardware counters
+//	(cycles, instructions, cache misses, branch misses) via perf_event_open when the kernel lets us.
+//	Everything here is compiled out unless ALZ_PROFILE is defined (see the alz_prof make target).
+//	Without it PROFILE_SCOPE expands to nothing, so normal builds pay zero overhead.
+//	Sections are reported to stderr at exit. Times are inclusive, so nested sections overlap their parents.
+//	A scope costs a couple of clock reads and, with counters, a syscall at each end, so they go around blocks
+//	and phases, not per-byte calls, where they'd mostly be timing themselves.
+//----------------------------------------
+
+#ifndef __PROFILE_HEADER_GUARD__
+#define __PROFILE_HEADER_GUARD__
+
+#ifdef ALZ_PROFILE
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+class Profiler
+{
+	public:
+
+		enum { NUM_COUNTERS = 4 };
+
+		static const char* counter_name( int c )
+		{
+			static const char* names[NUM_COUNTERS] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+			return names[c];
+		}
+
+		//----------------------------------------
+		//  Accumulated totals for one named section of code
+		//----------------------------------------
+		class Section
+		{
+			public:
+
+				const char* name;
+				std::atomic<uint64_t> calls;
+				std::atomic<uint64_t> nanos;
+				std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+				Section( const char* _name ) :
+					name( _name ),
+					calls( 0 ),
+					nanos( 0 )
+				{
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+						counters[c] = 0;
+					Profiler::get().add_section( this );
+				}
+		};
+
+		//----------------------------------------
+		//  One group of hardware counters per thread, since perf counters are per-task
+		//----------------------------------------
+		class CounterGroup
+		{
+			private:
+
+				int fds[NUM_COUNTERS];
+
+			public:
+
+				bool ok;
+
+				CounterGroup() :
+					ok( false )
+				{
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+						fds[c] = -1;
+#ifdef __linux__
+					static const uint64_t configs[NUM_COUNTERS] = {
+						PERF_COUNT_HW_CPU_CYCLES,
+						PERF_COUNT_HW_INSTRUCTIONS,
+						PERF_COUNT_HW_CACHE_MISSES,
+						PERF_COUNT_HW_BRANCH_MISSES };
+
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+					{
+						perf_event_attr attr;
+						memset( &attr, 0, sizeof(attr) );
+						attr.size = sizeof(attr);
+						attr.type = PERF_TYPE_HARDWARE;
+						attr.config = configs[c];
+						attr.disabled = c == 0 ? 1 : 0;
+						attr.exclude_kernel = 1;
+						attr.exclude_hv = 1;
+						attr.read_format = PERF_FORMAT_GROUP;
+
+						fds[c] = syscall( __NR_perf_event_open, &attr, 0, -1, c == 0 ? -1 : fds[0], 0 );
+						if( fds[c] < 0 )
+						{
+							close_all();
+							return;
+						}
+					}
+
+					ioctl( fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+					ioctl( fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+					ok = true;
+#endif
+				}
+
+				~CounterGroup()
+				{
+					close_all();
+				}
+
+				void close_all()
+				{
+#ifdef __linux__
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+					{
+						if( fds[c] >= 0 )
+							close( fds[c] );
+						fds[c] = -1;
+					}
+#endif
+					ok = false;
+				}
+
+				//----------------------------------------
+				//  Reads all counters with a single syscall. Returns false if unavailable.
+				//----------------------------------------
+				bool read_all( uint64_t* vals )
+				{
+#ifdef __linux__
+					if( !ok )
+						return false;
+					uint64_t buf[1+NUM_COUNTERS];
+					if( ::read( fds[0], buf, sizeof(buf) ) != sizeof(buf) )
+						return false;
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+						vals[c] = buf[1+c];
+					return true;
+#else
+					return false;
+#endif
+				}
+		};
+
+		//----------------------------------------
+		//  Times the enclosing scope into the given section
+		//----------------------------------------
+		class Scope
+		{
+			private:
+
+				typedef std::chrono::steady_clock Clock;
+
+				Section& sec;
+				Clock::time_point start;
+				uint64_t start_counters[NUM_COUNTERS];
+				bool have_counters;
+
+			public:
+
+				Scope( Section& _sec ) :
+					sec( _sec )
+				{
+					have_counters = Profiler::get().counters_enabled() && thread_counters().read_all( start_counters );
+					if( have_counters )
+						Profiler::get().saw_counters = true;
+					start = Clock::now();
+				}
+
+				~Scope()
+				{
+					Clock::time_point end = Clock::now();
+					sec.calls++;
+					sec.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
+
+					uint64_t end_counters[NUM_COUNTERS];
+					if( have_counters && thread_counters().read_all( end_counters ) )
+					{
+						for( int c = 0; c < NUM_COUNTERS; c++ )
+							sec.counters[c] += end_counters[c] - start_counters[c];
+					}
+				}
+		};
+
+	private:
+
+		std::mutex mutex;
+		std::vector<Section*> sections;
+		bool use_counters;
+
+		Profiler() :
+			saw_counters( false )
+		{
+			// Reading the counters costs a syscall per scope boundary, so allow turning them off
+			use_counters = getenv( "ALZ_PROFILE_NO_COUNTERS" ) == NULL;
+		}
+
+		static CounterGroup& thread_counters()
+		{
+			static thread_local CounterGroup group;
+			return group;
+		}
+
+	public:
+
+		// set once any thread managed to read its hardware counters
+		std::atomic<bool> saw_counters;
+
+		static Profiler& get()
+		{
+			static Profiler p;
+			return p;
+		}
+
+		bool counters_enabled() const { return use_counters; }
+
+		void add_section( Section* sec )
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			sections.push_back( sec );
+		}
+
+		void report( std::ostream& os )
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			bool have_counters = saw_counters.load();
+
+			os << "---- profile ----" << std::endl;
+			if( !have_counters )
+				os << "(hardware counters unavailable or disabled, timers only)" << std::endl;
+
+			os << std::left << std::setw(28) << "section" << std::right
+				<< std::setw(12) << "calls" << std::setw(12) << "ms";
+			if( have_counters )
+			{
+				for( int c = 0; c < NUM_COUNTERS; c++ )
+					os << std::setw(16) << counter_name(c);
+				os << std::setw(8) << "IPC";
+			}
+			os << std::endl;
+
+			// template instantiations get one section each, so merge sections by name, in order of first use
+			std::vector<bool> done( sections.size(), false );
+			for( size_t i = 0; i < sections.size(); i++ )
+			{
+				if( done[i] )
+					continue;
+
+				uint64_t calls = 0, nanos = 0;
+				uint64_t counters[NUM_COUNTERS] = { 0 };
+				for( size_t j = i; j < sections.size(); j++ )
+				{
+					const Section& s = *sections[j];
+					if( strcmp( s.name, sections[i]->name ) != 0 )
+						continue;
+					done[j] = true;
+					calls += s.calls.load();
+					nanos += s.nanos.load();
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+						counters[c] += s.counters[c].load();
+				}
+
+				os << std::left << std::setw(28) << sections[i]->name << std::right
+					<< std::setw(12) << calls
+					<< std::setw(12) << std::fixed << std::setprecision(2) << nanos / 1e6;
+				if( have_counters )
+				{
+					for( int c = 0; c < NUM_COUNTERS; c++ )
+						os << std::setw(16) << counters[c];
+					os << std::setw(8) << std::setprecision(2) << (counters[0] > 0 ? (double)counters[1] / counters[0] : 0.0);
+				}
+				os << std::endl;
+			}
+			os.unsetf( std::ios::fixed );
+		}
+
+		~Profiler()
+		{
+			report( std::cerr );
+		}
+};
+
+#define PROFILE_CONCAT2( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT2( a, b )
+
+// Each call site gets its own section, so the name lookup only happens once. They're never freed: the report runs
+// as the Profiler is destroyed at exit, and a static Section could already be gone by then.
+#define PROFILE_SCOPE( name ) \
+	static Profiler::Section& PROFILE_CONCAT( profile_section_, __LINE__ ) = *new Profiler::Section( name ); \
+	Profiler::Scope PROFILE_CONCAT( profile_scope_, __LINE__ )( PROFILE_CONCAT( profile_section_, __LINE__ ) )
+
+#else
+
+#define PROFILE_SCOPE( name )
+
+#endif
+
+#endif /* end of include guard: __PROFILE_HEADER_GUARD__ */
@@ -0,0 +1,260 @@
+//----------------------------------------
+//  Cheap counters describing what the compressor decided and where the time went.
+//	Only filled in when alz is run with --stats, so the normal path just carries a NULL pointer around.
+//----------------------------------------
+
+#ifndef __STATS_HEADER_GUARD__
+#define __STATS_HEADER_GUARD__
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+//----------------------------------------
+//  Adds the time spent in its scope to *target. Does nothing (not even read the clock) if target is NULL.
+//----------------------------------------
+class ScopedTimer
+{
+	private:
+
+		typedef std::chrono::steady_clock Clock;
+
+		double* target;
+		Clock::time_point start;
+
+	public:
+
+		ScopedTimer( double* _target ) :
+			target( _target )
+		{
+			if( target != NULL )
+				start = Clock::now();
+		}
+
+		~ScopedTimer()
+		{
+			if( target != NULL )
+				*target += std::chrono::duration<double>( Clock::now() - start ).count();
+		}
+};
+
+class Stats
+{
+	public:
+
+		size_t num_literals;
+		size_t num_copies;
+		size_t bytes_copied;
+		// copies at delta 0 longer than a byte, ie. runs of the previous byte
+		size_t num_runs;
+		size_t run_bytes;
+
+		// container blocks, and how many of them were stored raw (and how many bytes that was)
+		size_t num_blocks;
+		size_t num_stored_blocks;
+		size_t stored_bytes;
+		// long repeats found by the long distance pre-pass, and how many bytes they covered
+		size_t num_long_matches;
+		size_t long_bytes;
+
+		// number of match finder queries, and how many steps (candidates or tree characters) they took in total
+		size_t num_searches;
+		size_t num_search_steps;
+
+		// copy lengths, indexed directly by length below EXACT_LENS, and bucketed by number of significant bits above that
+		enum { EXACT_LENS = 32, EXACT_LEN_BITS = 6 };
+		std::vector<size_t> len_hist;
+		// copy deltas, bucketed by number of significant bits. Bucket b holds deltas in [2^(b-1), 2^b)
+		std::vector<size_t> delta_hist;
+
+		double input_secs;
+		double search_secs;
+		double update_secs;
+		double emit_secs;
+		double output_secs;
+
+		// suffix tree size at the end, if one was used
+		int num_nodes;
+		int num_edges;
+
+		Stats() :
+			num_literals(0),
+			num_copies(0),
+			bytes_copied(0),
+			num_runs(0),
+			run_bytes(0),
+			num_blocks(0),
+			num_stored_blocks(0),
+			stored_bytes(0),
+			num_long_matches(0),
+			long_bytes(0),
+			num_searches(0),
+			num_search_steps(0),
+			input_secs(0),
+			search_secs(0),
+			update_secs(0),
+			emit_secs(0),
+			output_secs(0),
+			num_nodes(-1),
+			num_edges(-1)
+		{
+		}
+
+		void add_literals( size_t n )
+		{
+			num_literals += n;
+		}
+
+		void add_copy( unsigned int delta, unsigned int len )
+		{
+			num_copies++;
+			bytes_copied += len;
+			if( delta == 0 && len > 1 )
+			{
+				num_runs++;
+				run_bytes += len;
+			}
+
+			size_t len_index = len;
+			if( len >= EXACT_LENS )
+				len_index = EXACT_LENS + num_bits( len ) - EXACT_LEN_BITS;
+			if( len_index >= len_hist.size() )
+				len_hist.resize( len_index+1, 0 );
+			len_hist[len_index]++;
+
+			unsigned int bucket = num_bits( delta );
+			if( bucket >= delta_hist.size() )
+				delta_hist.resize( bucket+1, 0 );
+			delta_hist[bucket]++;
+		}
+
+		static unsigned int num_bits( unsigned int x )
+		{
+			unsigned int bits = 0;
+			while( (x >> bits) != 0 )
+				bits++;
+			return bits;
+		}
+
+		void add_block( bool stored, size_t raw_len )
+		{
+			num_blocks++;
+			if( stored )
+			{
+				num_stored_blocks++;
+				stored_bytes += raw_len;
+			}
+		}
+
+		void add_long_match( size_t len )
+		{
+			num_long_matches++;
+			long_bytes += len;
+		}
+
+		void add_search( size_t steps )
+		{
+			num_searches++;
+			num_search_steps += steps;
+		}
+
+		//----------------------------------------
+		//  Adds in the counts from another part of the same input. Times add up too, so with threads they're CPU time.
+		//----------------------------------------
+		void merge( const Stats& other )
+		{
+			num_literals += other.num_literals;
+			num_copies += other.num_copies;
+			bytes_copied += other.bytes_copied;
+			num_runs += other.num_runs;
+			run_bytes += other.run_bytes;
+			num_blocks += other.num_blocks;
+			num_stored_blocks += other.num_stored_blocks;
+			stored_bytes += other.stored_bytes;
+			num_long_matches += other.num_long_matches;
+			long_bytes += other.long_bytes;
+			num_searches += other.num_searches;
+			num_search_steps += other.num_search_steps;
+
+			if( other.len_hist.size() > len_hist.size() )
+				len_hist.resize( other.len_hist.size(), 0 );
+			for( size_t k = 0; k < other.len_hist.size(); k++ )
+				len_hist[k] += other.len_hist[k];
+			if( other.delta_hist.size() > delta_hist.size() )
+				delta_hist.resize( other.delta_hist.size(), 0 );
+			for( size_t b = 0; b < other.delta_hist.size(); b++ )
+				delta_hist[b] += other.delta_hist[b];
+
+			input_secs += other.input_secs;
+			search_secs += other.search_secs;
+			update_secs += other.update_secs;
+			emit_secs += other.emit_secs;
+			output_secs += other.output_secs;
+
+			if( other.num_nodes >= 0 )
+			{
+				num_nodes = std::max( num_nodes, 0 ) + other.num_nodes;
+				num_edges = std::max( num_edges, 0 ) + other.num_edges;
+			}
+		}
+
+		void output( std::ostream& os ) const
+		{
+			size_t num_commands = num_literals + num_copies;
+
+			os << "---- stats ----" << std::endl;
+			os << "commands:  " << num_commands << " (" << num_literals << " literals, " << num_copies << " copies)" << std::endl;
+			os << "bytes:     " << num_literals << " literal, " << bytes_copied << " copied";
+			if( num_copies > 0 )
+				os << ", avg copy len " << std::setprecision(3) << (double)bytes_copied / num_copies;
+			os << std::endl;
+
+			os << "runs:      " << num_runs << " (" << run_bytes << " bytes)" << std::endl;
+			os << "blocks:    " << num_blocks << " (" << num_stored_blocks << " stored, " << stored_bytes << " bytes)" << std::endl;
+
+			if( num_long_matches > 0 )
+				os << "long:      " << num_long_matches << " (" << long_bytes << " bytes)" << std::endl;
+
+			os << "searches:  " << num_searches << ", " << num_search_steps << " steps";
+			if( num_searches > 0 )
+				os << ", avg " << std::setprecision(3) << (double)num_search_steps / num_searches << " steps/search";
+			os << std::endl;
+
+			if( num_nodes >= 0 )
+				os << "tree:      " << num_nodes << " nodes, " << num_edges << " edges" << std::endl;
+
+			os << "time (s):  input " << input_secs
+				<< ", search " << search_secs
+				<< ", update " << update_secs
+				<< ", emit " << emit_secs
+				<< ", output " << output_secs << std::endl;
+
+			os << "copy length histogram:" << std::endl;
+			for( size_t k = 0; k < len_hist.size(); k++ )
+			{
+				if( len_hist[k] == 0 )
+					continue;
+				if( k < EXACT_LENS )
+					os << "  " << std::setw(6) << k << " : " << len_hist[k] << std::endl;
+				else
+				{
+					size_t lo = (size_t)1 << (k - EXACT_LENS + EXACT_LEN_BITS - 1);
+					os << "  " << std::setw(6) << lo << "-" << std::setw(6) << std::left << 2*lo-1 << std::right << " : " << len_hist[k] << std::endl;
+				}
+			}
+
+			os << "copy delta histogram:" << std::endl;
+			for( size_t b = 0; b < delta_hist.size(); b++ )
+			{
+				if( delta_hist[b] == 0 )
+					continue;
+				size_t lo = b == 0 ? 0 : ((size_t)1 << (b-1));
+				size_t hi = ((size_t)1 << b) - 1;
+				os << "  " << std::setw(6) << lo << "-" << std::setw(6) << std::left << hi << std::right << " : " << delta_hist[b] << std::endl;
+			}
+		}
+};
+
+#endif /* end of include guard: __STATS_HEADER_GUARD__ */
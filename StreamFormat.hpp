@@ -0,0 +1,210 @@
+//----------------------------------------
+//  The split stream block format (container::BLOCK_STREAMS): the token format's sequences, with each kind of
+//	field pulled out into a stream of its own.
+//
+//	payload:    lengths stream size (4 bytes LE), literals stream size (4 bytes LE), then the three streams
+//	lengths:    each sequence's token and length extension bytes, as in the token format
+//	literals:   all the literal runs' bytes, back to back
+//	deltas:     each copy's delta, token_format::offset_bytes( window_bits ) bytes LE, to the end of the payload
+//
+//	The decoder keeps a cursor in each stream. Where the next literal run and the next delta come from doesn't
+//	depend on decoding the lengths in between, so the loads for one sequence's fields can all be in flight at
+//	once, instead of each waiting to find out where the last one ended.
+//	Each stream is also all one kind of data, which is what an entropy coder per stream would want. There isn't
+//	one yet, so for now it's the token format's size, plus the 8 bytes of stream sizes.
+//----------------------------------------
+
+#ifndef __STREAMFORMAT_HEADER_GUARD__
+#define __STREAMFORMAT_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Container.hpp"
+#include "TokenFormat.hpp"
+
+namespace stream_format
+{
+	static const size_t STREAMS_HEADER_SIZE = 8;
+
+	//----------------------------------------
+	//  Where compress_block() sends its commands for a BLOCK_STREAMS block
+	//----------------------------------------
+	class Emitter
+	{
+		private:
+
+			std::vector<BYTE> lengths;
+			std::vector<BYTE> literal_bytes;
+			std::vector<BYTE> deltas;
+			// how many of literal_bytes' last bytes aren't in a sequence yet
+			size_t num_pending;
+			unsigned int num_offset_bytes;
+
+			std::vector<BYTE> data;
+
+			void write_token( unsigned int match_nibble )
+			{
+				lengths.push_back( (std::min( num_pending, (size_t)token_format::NIBBLE_MAX ) << 4) | match_nibble );
+				if( num_pending >= token_format::NIBBLE_MAX )
+					token_format::write_extra_len( lengths, num_pending - token_format::NIBBLE_MAX );
+				num_pending = 0;
+			}
+
+		public:
+
+			static const container::BlockType BLOCK_TYPE = container::BLOCK_STREAMS;
+
+			Emitter( unsigned int window_bits ) :
+				num_pending( 0 ),
+				num_offset_bytes( token_format::offset_bytes( window_bits ) )
+			{
+			}
+
+			//----------------------------------------
+			//  The same costs as the token format
+			//----------------------------------------
+			bool copy_pays( unsigned int delta, unsigned int len ) const
+			{
+				return len >= token_format::MIN_MATCH && copy_saving( delta, len ) > 0;
+			}
+
+			int copy_saving( unsigned int /*delta*/, unsigned int len ) const
+			{
+				return 8 * ((int)len - 1 - (int)num_offset_bytes);
+			}
+
+			void literals( const BYTE* p, int n )
+			{
+				literal_bytes.insert( literal_bytes.end(), p, p+n );
+				num_pending += n;
+			}
+
+			void copy( unsigned int delta, unsigned int len )
+			{
+				unsigned int extra = len - token_format::MIN_MATCH;
+				write_token( std::min( extra, token_format::NIBBLE_MAX ) );
+				if( extra >= token_format::NIBBLE_MAX )
+					token_format::write_extra_len( lengths, extra - token_format::NIBBLE_MAX );
+				for( unsigned int b = 0; b < num_offset_bytes; b++ )
+					deltas.push_back( (delta >> (8*b)) & 0xff );
+			}
+
+			void clear()
+			{
+				lengths.clear();
+				literal_bytes.clear();
+				deltas.clear();
+				num_pending = 0;
+			}
+
+			//----------------------------------------
+			//  The block's payload, good until the next clear()
+			//----------------------------------------
+			const std::vector<BYTE>& finish()
+			{
+				if( num_pending > 0 )
+					write_token( 0 );
+
+				data.clear();
+				container::write_u32( data, lengths.size() );
+				container::write_u32( data, literal_bytes.size() );
+				data.insert( data.end(), lengths.begin(), lengths.end() );
+				data.insert( data.end(), literal_bytes.begin(), literal_bytes.end() );
+				data.insert( data.end(), deltas.begin(), deltas.end() );
+				return data;
+			}
+	};
+
+	//----------------------------------------
+	//  Decodes the len byte payload at p onto the end of out, which should come to out_end bytes.
+	//	window_bits is what the deltas were written with. Returns false if it's corrupt. Either way out is cut
+	//	back to what was decoded.
+	//----------------------------------------
+	inline bool decode( const BYTE* p, size_t len, std::vector<BYTE>& out, size_t out_end, unsigned int window_bits )
+	{
+		if( len < STREAMS_HEADER_SIZE )
+			return false;
+		size_t lengths_len = container::read_u32( p );
+		size_t literals_len = container::read_u32( p+4 );
+		if( lengths_len > len - STREAMS_HEADER_SIZE || literals_len > len - STREAMS_HEADER_SIZE - lengths_len )
+			return false;
+
+		// a cursor and an end for each stream
+		const BYTE* lp = p + STREAMS_HEADER_SIZE;
+		const BYTE* lengths_end = lp + lengths_len;
+		const BYTE* bp = lengths_end;
+		const BYTE* literals_end = bp + literals_len;
+		const BYTE* dp = literals_end;
+		const BYTE* deltas_end = p + len;
+
+		unsigned int num_offset_bytes = token_format::offset_bytes( window_bits );
+		const size_t CHUNK = token_format::CHUNK;
+		const size_t NIBBLE_MAX = token_format::NIBBLE_MAX;
+
+		// write straight into the space the block will fill
+		size_t pos = out.size();
+		out.resize( out_end );
+		BYTE* base = out.data();
+
+		bool corrupt = false;
+		while( pos < out_end )
+		{
+			if( lp >= lengths_end )
+			{
+				corrupt = true;
+				break;
+			}
+			BYTE token = *lp++;
+
+			size_t num_literals = token >> 4;
+			if( num_literals == NIBBLE_MAX && !token_format::read_extra_len( lp, lengths_end, num_literals ) )
+				corrupt = true;
+			else if( num_literals > (size_t)(literals_end - bp) || num_literals > out_end - pos )
+				corrupt = true;
+			if( corrupt )
+				break;
+			if( num_literals <= 2*CHUNK && (size_t)(literals_end - bp) >= 2*CHUNK && out_end - pos >= 2*CHUNK )
+				// a fixed size copy is a couple of moves instead of a call. What it runs over gets written again later.
+				memcpy( base + pos, bp, 2*CHUNK );
+			else
+				memcpy( base + pos, bp, num_literals );
+			bp += num_literals;
+			pos += num_literals;
+
+			if( pos == out_end )
+				// the last sequence may have no copy
+				break;
+
+			size_t copy_len = token & NIBBLE_MAX;
+			if( copy_len == NIBBLE_MAX && !token_format::read_extra_len( lp, lengths_end, copy_len ) )
+				corrupt = true;
+			else if( (size_t)(deltas_end - dp) < num_offset_bytes )
+				corrupt = true;
+			if( corrupt )
+				break;
+			copy_len += token_format::MIN_MATCH;
+
+			size_t delta = 0;
+			for( unsigned int b = 0; b < num_offset_bytes; b++ )
+				delta |= (size_t)dp[b] << (8*b);
+			dp += num_offset_bytes;
+
+			if( delta >= pos || copy_len > out_end - pos )
+			{
+				corrupt = true;
+				break;
+			}
+			token_format::copy_match( base, pos, delta, copy_len, out_end );
+			pos += copy_len;
+		}
+
+		out.resize( pos );
+		// every stream should be used up
+		return !corrupt && lp == lengths_end && bp == literals_end && dp == deltas_end;
+	}
+}
+
+#endif /* end of include guard: __STREAMFORMAT_HEADER_GUARD__ */
@@ -0,0 +1,412 @@
+//----------------------------------------
+//  Suffix array match finder: an offline alternative to the online SuffixTree.
+//	The input is cut into blocks, and for each block we build a suffix array with SA-IS [Nong, Zhang & Chan 2009]
+//	over the block together with the window of history before it.
+//	As the finder moves through the block, a RankSet keeps the ranks of just the positions in the window behind it.
+//	A query walks outwards from the position's rank through those, so it never looks at future or too-old positions.
+//	Each one further out shares no more with the position than the one before, so the walk stops as soon as it
+//	can't beat what it already has. Until then, each step either finds a longer match or is one of the few
+//	positions so close that the copy would run into itself, so a query takes a few hundred steps at most,
+//	and finds the longest match in the window, like the brute force search.
+//	That's two ints per byte of the current block plus a bit per byte, instead of the pointer-heavy Node/Edge
+//	graph, and since blocks don't depend on each other they can be built independently.
+//	Drop-in for SuffixTree: add_next_letter() and find_longest_match_after() behave the same way.
+//----------------------------------------
+
+#ifndef __SUFFIXARRAY_HEADER_GUARD__
+#define __SUFFIXARRAY_HEADER_GUARD__
+
+#include <vector>
+#include <cassert>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+
+#include "MatchLength.hpp"
+#include "Profile.hpp"
+
+namespace suffix_array_impl
+{
+	//----------------------------------------
+	//  Plain comparison sort, for tiny inputs where SA-IS isn't worth it
+	//----------------------------------------
+	inline std::vector<int> sa_naive( const std::vector<int>& s )
+	{
+		int n = s.size();
+		std::vector<int> sa( n );
+		for( int i = 0; i < n; i++ )
+			sa[i] = i;
+
+		std::sort( sa.begin(), sa.end(), [&]( int l, int r )
+		{
+			if( l == r ) return false;
+			while( l < n && r < n )
+			{
+				if( s[l] != s[r] ) return s[l] < s[r];
+				l++;
+				r++;
+			}
+			return l == n;
+		} );
+		return sa;
+	}
+
+	//----------------------------------------
+	//  SA-IS. s holds values in [0, upper].
+	//----------------------------------------
+	inline std::vector<int> sa_is( const std::vector<int>& s, int upper )
+	{
+		int n = s.size();
+		if( n < 10 )
+			return sa_naive( s );
+
+		std::vector<int> sa( n );
+
+		// ls[i] is true for S-type suffixes (smaller than the next one)
+		std::vector<bool> ls( n, false );
+		for( int i = n-2; i >= 0; i-- )
+			ls[i] = (s[i] == s[i+1]) ? ls[i+1] : (s[i] < s[i+1]);
+
+		// bucket boundaries: sum_l[c] is where c's L-type suffixes start, sum_s[c] where its S-types start
+		std::vector<int> sum_l( upper+1, 0 ), sum_s( upper+1, 0 );
+		for( int i = 0; i < n; i++ )
+		{
+			if( !ls[i] )
+				sum_s[ s[i] ]++;
+			else
+				sum_l[ s[i]+1 ]++;
+		}
+		for( int c = 0; c <= upper; c++ )
+		{
+			sum_s[c] += sum_l[c];
+			if( c < upper )
+				sum_l[c+1] += sum_s[c];
+		}
+
+		std::vector<int> buf( upper+1 );
+		auto induce = [&]( const std::vector<int>& lms )
+		{
+			std::fill( sa.begin(), sa.end(), -1 );
+
+			std::copy( sum_s.begin(), sum_s.end(), buf.begin() );
+			for( size_t k = 0; k < lms.size(); k++ )
+			{
+				int d = lms[k];
+				if( d == n ) continue;
+				sa[ buf[ s[d] ]++ ] = d;
+			}
+
+			std::copy( sum_l.begin(), sum_l.end(), buf.begin() );
+			sa[ buf[ s[n-1] ]++ ] = n-1;
+			for( int i = 0; i < n; i++ )
+			{
+				int v = sa[i];
+				if( v >= 1 && !ls[v-1] )
+					sa[ buf[ s[v-1] ]++ ] = v-1;
+			}
+
+			std::copy( sum_l.begin(), sum_l.end(), buf.begin() );
+			for( int i = n-1; i >= 0; i-- )
+			{
+				int v = sa[i];
+				if( v >= 1 && ls[v-1] )
+					sa[ --buf[ s[v-1]+1 ] ] = v-1;
+			}
+		};
+
+		// find the LMS (leftmost S-type) positions
+		std::vector<int> lms_map( n+1, -1 );
+		std::vector<int> lms;
+		for( int i = 1; i < n; i++ )
+		{
+			if( !ls[i-1] && ls[i] )
+			{
+				lms_map[i] = lms.size();
+				lms.push_back( i );
+			}
+		}
+		int m = lms.size();
+
+		induce( lms );
+
+		if( m > 0 )
+		{
+			// name the LMS substrings in sorted order, and recurse if any names repeat
+			std::vector<int> sorted_lms;
+			sorted_lms.reserve( m );
+			for( int i = 0; i < n; i++ )
+			{
+				if( lms_map[ sa[i] ] != -1 )
+					sorted_lms.push_back( sa[i] );
+			}
+
+			std::vector<int> rec_s( m );
+			int rec_upper = 0;
+			rec_s[ lms_map[ sorted_lms[0] ] ] = 0;
+			for( int k = 1; k < m; k++ )
+			{
+				int l = sorted_lms[k-1];
+				int r = sorted_lms[k];
+				int end_l = (lms_map[l]+1 < m) ? lms[ lms_map[l]+1 ] : n;
+				int end_r = (lms_map[r]+1 < m) ? lms[ lms_map[r]+1 ] : n;
+				bool same = true;
+				if( end_l - l != end_r - r )
+					same = false;
+				else
+				{
+					while( l < end_l && s[l] == s[r] )
+					{
+						l++;
+						r++;
+					}
+					if( l == n || s[l] != s[r] )
+						same = false;
+				}
+				if( !same )
+					rec_upper++;
+				rec_s[ lms_map[ sorted_lms[k] ] ] = rec_upper;
+			}
+
+			std::vector<int> rec_sa = sa_is( rec_s, rec_upper );
+			for( int k = 0; k < m; k++ )
+				sorted_lms[k] = lms[ rec_sa[k] ];
+			induce( sorted_lms );
+		}
+
+		return sa;
+	}
+
+	inline std::vector<int> build_suffix_array( const BYTE* chars, int n )
+	{
+		std::vector<int> s( chars, chars+n );
+		return sa_is( s, 255 );
+	}
+
+	//----------------------------------------
+	//  A set of ints in [0, n): a bit for each, then a bit for each word of those saying whether it has any set,
+	//	and so on up to a single word. Finding the next member either way is a word scan per level.
+	//----------------------------------------
+	class RankSet
+	{
+		private:
+
+			std::vector< std::vector<uint64_t> > levels;
+
+		public:
+
+			void reset( int n )
+			{
+				levels.clear();
+				do
+				{
+					n = (n+63) / 64;
+					levels.push_back( std::vector<uint64_t>( n, 0 ) );
+				}
+				while( n > 1 );
+			}
+
+			void insert( int k )
+			{
+				for( size_t l = 0; l < levels.size(); l++, k >>= 6 )
+				{
+					uint64_t& word = levels[l][k >> 6];
+					bool had_any = word != 0;
+					word |= (uint64_t)1 << (k & 63);
+					if( had_any )
+						// the levels above already know
+						break;
+				}
+			}
+
+			void erase( int k )
+			{
+				for( size_t l = 0; l < levels.size(); l++, k >>= 6 )
+				{
+					uint64_t& word = levels[l][k >> 6];
+					word &= ~((uint64_t)1 << (k & 63));
+					if( word != 0 )
+						break;
+				}
+			}
+
+			//----------------------------------------
+			//  The nearest member after k (dir +1) or before it (dir -1), or -1 if there isn't one
+			//----------------------------------------
+			int nearest( int k, int dir ) const
+			{
+				// go up until a word has a member on that side of k's bit...
+				size_t l = 0;
+				for( ; l < levels.size(); l++, k >>= 6 )
+				{
+					int bit = k & 63;
+					uint64_t word = levels[l][k >> 6];
+					if( dir > 0 )
+						word = bit == 63 ? 0 : word & (~(uint64_t)0 << (bit+1));
+					else
+						word &= ((uint64_t)1 << bit) - 1;
+					if( word != 0 )
+					{
+						k = (k & ~63) | (dir > 0 ? __builtin_ctzll( word ) : 63 - __builtin_clzll( word ));
+						break;
+					}
+				}
+				if( l == levels.size() )
+					return -1;
+
+				// ...then back down to the member in it closest to k
+				while( l-- > 0 )
+				{
+					uint64_t word = levels[l][k];
+					k = (k << 6) | (dir > 0 ? __builtin_ctzll( word ) : 63 - __builtin_clzll( word ));
+				}
+				return k;
+			}
+	};
+}
+
+class SuffixArray
+{
+	private:
+
+		const std::vector<BYTE>& chars;
+		int max_search_len;
+		int window;
+		int block_size;
+
+		// the current block covers [block_start, block_end), and its arrays index from base
+		int base;
+		int block_start;
+		int block_end;
+		std::vector<int> sa;
+		std::vector<int> rank;
+		// the ranks of the positions in [window_start, window_end)
+		suffix_array_impl::RankSet in_window;
+		int window_start;
+		int window_end;
+
+		int curr_i;
+
+		//----------------------------------------
+		//  Builds the arrays for the block starting at start, with a window of history before it
+		//	and enough lookahead after it that matches starting in the block aren't cut short
+		//----------------------------------------
+		void build_block( int start )
+		{
+			PROFILE_SCOPE( "SuffixArray::build_block" );
+			block_start = start;
+			block_end = std::min( start + block_size, (int)chars.size() );
+			base = std::max( 0, start - window );
+			int end = std::min( block_end + max_search_len, (int)chars.size() );
+
+			sa = suffix_array_impl::build_suffix_array( &chars[base], end-base );
+			rank.resize( sa.size() );
+			for( int k = 0; k < (int)sa.size(); k++ )
+				rank[ sa[k] ] = k;
+
+			in_window.reset( sa.size() );
+			window_start = base;
+			window_end = base;
+		}
+
+		//----------------------------------------
+		//  Brings the window up to the bytes before position i
+		//----------------------------------------
+		void slide_window( int i )
+		{
+			for( ; window_end < i; window_end++ )
+				in_window.insert( rank[ window_end-base ] );
+			for( ; window_start < i - window; window_start++ )
+				in_window.erase( rank[ window_start-base ] );
+		}
+
+		//----------------------------------------
+		//  Looks at the window's ranks going away from r in direction dir (+1 or -1), keeping the best match for
+		//	position i, whose bytes are target
+		//----------------------------------------
+		size_t walk( const std::vector<BYTE>& target, int i, int r, int dir, int min_pos, int max_len, int& best_pos, int& best_len ) const
+		{
+			size_t steps = 0;
+			for( int k = in_window.nearest( r, dir ); k >= 0; k = in_window.nearest( k, dir ) )
+			{
+				steps++;
+				int p = sa[k] + base;
+				int len = match_length( target.data(), &chars[p], max_len );
+				if( len <= best_len )
+					// everything further away shares even less
+					break;
+				if( p < min_pos )
+					continue;
+
+				// the copy can't run into the bytes it's producing
+				int usable = std::min( len, i-p );
+				if( usable > best_len || (usable == best_len && p > best_pos) )
+				{
+					best_len = usable;
+					best_pos = p;
+				}
+			}
+			return steps;
+		}
+
+	public:
+
+		enum { DEFAULT_BLOCK_SIZE = 1 << 18 };
+
+		SuffixArray( const std::vector<BYTE>& _chars, int _max_search_len, int _window, int _block_size = DEFAULT_BLOCK_SIZE ) :
+			chars( _chars ),
+			max_search_len( _max_search_len ),
+			window( _window ),
+			// a block at least as big as the window, so the history rebuilt with each block isn't most of the work
+			block_size( std::max( _block_size, _window ) ),
+			base( 0 ),
+			block_start( 0 ),
+			block_end( 0 ),
+			window_start( 0 ),
+			window_end( 0 ),
+			curr_i( 0 )
+		{
+		}
+
+		//----------------------------------------
+		//  Returns false if all done
+		//----------------------------------------
+		bool add_next_letter()
+		{
+			if( curr_i < (int)chars.size() )
+			{
+				curr_i++;
+				return true;
+			}
+			else
+				return false;
+		}
+
+		//----------------------------------------
+		//  Same contract as SuffixTree::find_longest_match_after. The target must be the bytes at the next letter's position.
+		//----------------------------------------
+		std::pair<int,int> find_longest_match_after( const std::vector<BYTE>& target, int min_pos, size_t* num_steps = NULL )
+		{
+			int i = curr_i;
+			assert( i < (int)chars.size() );
+			assert( target.empty() || target[0] == chars[i] );
+
+			if( i >= block_end )
+				build_block( i );
+
+			slide_window( i );
+
+			int best_pos = -1;
+			int best_len = 0;
+			int r = rank[ i-base ];
+			int max_len = std::min( (int)target.size(), max_search_len );
+			size_t steps = walk( target, i, r, -1, min_pos, max_len, best_pos, best_len );
+			steps += walk( target, i, r, +1, min_pos, max_len, best_pos, best_len );
+
+			if( num_steps != NULL )
+				*num_steps += steps;
+
+			return std::pair<int,int>( best_pos, best_len );
+		}
+};
+
+#endif /* end of include guard: __SUFFIXARRAY_HEADER_GUARD__ */
@@ -19,6 +19,8 @@
 #include <boost/unordered_map.hpp>
 #include <boost/foreach.hpp>
 
+#include "MatchLength.hpp"
+
 using namespace std;
 
 typedef unsigned char T;
@@ -169,6 +171,8 @@ class SuffixTree
 					return edges[c];
 				}
 
+				const EdgeMap& get_edges() const { return edges; }
+
 				void output_dfs( ostream& os, const vector<T>& chars, int last, int depth ) const
 				{
 
@@ -384,13 +388,42 @@ class SuffixTree
 			root->output_dfs( os, chars, curr_i-1, 0 );
 		}
 
+		//----------------------------------------
+		//  Counts the explicit nodes (including root) and edges reachable from root. Just for stats.
+		//	Done with an explicit stack, since the tree can get very deep on long runs
+		//----------------------------------------
+		void count_nodes_edges( int& num_nodes, int& num_edges ) const
+		{
+			num_nodes = 0;
+			num_edges = 0;
+
+			vector<const Node*> stack;
+			stack.push_back( root );
+			while( !stack.empty() )
+			{
+				const Node* n = stack.back();
+				stack.pop_back();
+				num_nodes++;
+
+				BOOST_FOREACH( const Node::EdgeMap::value_type& kv, n->get_edges() )
+				{
+					// get_edge() leaves NULL entries behind for chars it didn't find
+					if( kv.second == NULL )
+						continue;
+					num_edges++;
+					stack.push_back( kv.second->get_end_const() );
+				}
+			}
+		}
+
 		//----------------------------------------
 		//  rv.first = index of longest match
 		//	rv.second = length of longest match
 		//	This returns the position of the LATEST occurrence of the longest, only if it's after the given min_pos
 		//	Kind of useless for our compression problem...
+		//	If num_steps is given, the number of tree characters walked (plus edges and lookups) is added to it
 		//----------------------------------------
-		pair<int,int> find_longest_match_after( const vector<T>& target, int min_pos ) const
+		pair<int,int> find_longest_match_after( const vector<T>& target, int min_pos, size_t* num_steps = NULL ) const
 		{
 				Node::Edge* e = root->get_edge( target[0] );
 				if( e == NULL )
@@ -398,51 +431,73 @@ class SuffixTree
 					return pair<int,int>(-1, 0);
 
 				// walk the tree, and if we find a match that is after the min_pos, set it as the best
+				// Since every occurrence of a longer prefix is also an occurrence of the shorter one, the latest start
+				// can only move earlier as the match grows. So once a prefix is too old, nothing longer can qualify.
+				// (The latest occurrences are exact as long as the target is no longer than max_search_len.)
 				int best_pos = -1;
 				int best_len = 0;
 
-				int edge_offset = -1;
-				for( int tpos = 0; tpos < target.size(); tpos++ )
+				int tpos = 0;
+				size_t steps = 0;
+				while( e != NULL && tpos < (int)target.size() )
 				{
-					assert( e != NULL );
-					edge_offset++;
-
-					// are we done with the current edge?
+					// compare as much of this edge as we can in one go
 					// watch out for the implicit bound too
-					if( (e->get_sub().first+edge_offset) > min( e->get_sub().second, curr_i-1 ) )
-					{
-						// we've ran past this edge. Need to look for the next edge
-						e = e->get_end()->get_edge( target[tpos] );
+					int edge_first = e->get_sub().first;
+					int edge_last = min( e->get_sub().second, curr_i-1 );
+					int span = min( edge_last-edge_first+1, (int)target.size()-tpos );
+					int len = match_length( &chars[edge_first], &target[tpos], span );
+					steps += len+1;
 
-						if( e == NULL )
-							// can't find a longer match
-							break;
+					if( len == 0 )
+						break;
 
-						edge_offset = 0;	// starting new edge
-					}
-					else
-					{
-						// is this character a match?
-						int first_pos = e->get_sub().first + edge_offset;
-						if( chars[ first_pos ] != target[tpos] )
-							// nope - can't find a longer match
-							break;
-					}
-
-					// so we're at a match right now
-					// is its position after our min?
-					int first_pos = e->get_sub().first + edge_offset;
-					int latest_end = e->get_latest_occurrence( first_pos );
-					int curr_len = tpos+1;
-					int latest_start = latest_end - curr_len + 1;
+					// is the longest match on this edge after our min?
+					int latest_start = e->get_latest_occurrence( edge_first+len-1 ) - (tpos+len) + 1;
 					if( latest_start >= min_pos )
 					{
 						// ok we got one! since we're going in order, this is always better
-						best_len = curr_len;
+						best_len = tpos+len;
 						best_pos = latest_start;
 					}
+					else
+					{
+						// binary search for the longest prefix on this edge that still is
+						// invariant: lo chars are ok (or lo == 0), hi chars are not
+						int lo = 0;
+						int hi = len;
+						while( hi-lo > 1 )
+						{
+							int mid = (lo+hi)/2;
+							int mid_start = e->get_latest_occurrence( edge_first+mid-1 ) - (tpos+mid) + 1;
+							if( mid_start >= min_pos )
+								lo = mid;
+							else
+								hi = mid;
+							steps++;
+						}
+
+						if( lo > 0 )
+						{
+							best_len = tpos+lo;
+							best_pos = e->get_latest_occurrence( edge_first+lo-1 ) - best_len + 1;
+						}
+						// can't find a later, longer match
+						break;
+					}
+
+					tpos += len;
+					if( len < span || tpos == (int)target.size() )
+						// mismatch in the middle of the edge, or we're all done
+						break;
+
+					// we've ran past this edge. Need to look for the next edge
+					e = e->get_end()->get_edge( target[tpos] );
 				}
 
+				if( num_steps != NULL )
+					*num_steps += steps;
+
 				if( best_len > 0 )
 				{
 					assert( best_len <= target.size() );
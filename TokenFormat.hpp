@@ -0,0 +1,240 @@
+//----------------------------------------
+//  The byte-aligned block format (container::BLOCK_TOKENS), in the style of LZ4's.
+//	A block is a run of sequences, each a literal run followed by a copy:
+//
+//	token:     1 byte, literal run length in the high nibble, copy length - MIN_MATCH in the low one
+//	           (15 in either means more follows: bytes added on, each 255 meaning another one comes after it)
+//	literals:  the literal run's bytes, raw
+//	delta:     offset_bytes( window_bits ) bytes LE, as in the bit format (0 is a run of the previous byte)
+//	length:    the copy length's extra bytes, if any
+//
+//	The last sequence of a block is only a literal run, and stops after its literals.
+//	Everything's whole bytes, so the decoder copies literal runs with memcpy and never shifts or masks a bit.
+//	It's bigger than the bit format, since short copies and lone literals don't pack down as far.
+//----------------------------------------
+
+#ifndef __TOKENFORMAT_HEADER_GUARD__
+#define __TOKENFORMAT_HEADER_GUARD__
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Container.hpp"
+
+namespace token_format
+{
+	// a shorter copy costs more than its literals would
+	static const unsigned int MIN_MATCH = 4;
+	// a nibble of 15 means there's more length in the bytes after
+	static const unsigned int NIBBLE_MAX = 15;
+	// the decoder copies in chunks of this many bytes where there's room to run over
+	static const size_t CHUNK = 8;
+
+	//----------------------------------------
+	//  How many bytes a delta takes with the given window
+	//----------------------------------------
+	inline unsigned int offset_bytes( unsigned int window_bits )
+	{
+		return window_bits <= 16 ? 2 : window_bits <= 24 ? 3 : 4;
+	}
+
+	//----------------------------------------
+	//  Appends the part of a length beyond the nibble (which was NIBBLE_MAX)
+	//----------------------------------------
+	inline void write_extra_len( std::vector<BYTE>& out, size_t extra )
+	{
+		for( ; extra >= 255; extra -= 255 )
+			out.push_back( 255 );
+		out.push_back( extra );
+	}
+
+	//----------------------------------------
+	//  Adds the extra length bytes at p to len. Returns false if they run past end.
+	//----------------------------------------
+	inline bool read_extra_len( const BYTE*& p, const BYTE* end, size_t& len )
+	{
+		while( p < end )
+		{
+			BYTE b = *p++;
+			len += b;
+			if( b != 255 )
+				return true;
+		}
+		return false;
+	}
+
+	//----------------------------------------
+	//  Copies len bytes to base[pos] from delta+1 bytes before it, for a decoder writing into a buffer that's
+	//	out_end long. The caller has checked it all fits.
+	//----------------------------------------
+	inline void copy_match( BYTE* base, size_t pos, size_t delta, size_t len, size_t out_end )
+	{
+		BYTE* dst = base + pos;
+		const BYTE* src = dst - delta - 1;
+		if( delta+1 >= CHUNK && out_end - pos >= len + CHUNK )
+		{
+			// Chunk by chunk, running over the end. Each chunk's source is at least a chunk back, so it's
+			// already been written even when the copy overlaps itself.
+			for( size_t i = 0; i < len; i += CHUNK )
+				memcpy( dst+i, src+i, CHUNK );
+		}
+		else if( delta+1 >= len )
+			memcpy( dst, src, len );
+		else if( delta == 0 )
+			// a run of the previous byte
+			memset( dst, *src, len );
+		else
+		{
+			// overlapping, so this repeats bytes the copy itself is writing
+			for( size_t i = 0; i < len; i++ )
+				dst[i] = src[i];
+		}
+	}
+
+	//----------------------------------------
+	//  Where compress_block() sends its commands for a BLOCK_TOKENS block. Literals wait until the copy that ends
+	//	their run comes along, since the token says how many there are.
+	//----------------------------------------
+	class Emitter
+	{
+		private:
+
+			std::vector<BYTE> data;
+			std::vector<BYTE> pending;
+			unsigned int num_offset_bytes;
+
+			void write_sequence( unsigned int match_nibble )
+			{
+				size_t num_literals = pending.size();
+				data.push_back( (std::min( num_literals, (size_t)NIBBLE_MAX ) << 4) | match_nibble );
+				if( num_literals >= NIBBLE_MAX )
+					write_extra_len( data, num_literals - NIBBLE_MAX );
+				data.insert( data.end(), pending.begin(), pending.end() );
+				pending.clear();
+			}
+
+		public:
+
+			static const container::BlockType BLOCK_TYPE = container::BLOCK_TOKENS;
+
+			Emitter( unsigned int window_bits ) :
+				num_offset_bytes( offset_bytes( window_bits ) )
+			{
+			}
+
+			//----------------------------------------
+			//  Whether a copy is smaller than its bytes as literals. Lengths and extra bytes aside, a copy
+			//	costs a token and a delta, and a literal one byte.
+			//----------------------------------------
+			bool copy_pays( unsigned int delta, unsigned int len ) const
+			{
+				return len >= MIN_MATCH && copy_saving( delta, len ) > 0;
+			}
+
+			int copy_saving( unsigned int /*delta*/, unsigned int len ) const
+			{
+				return 8 * ((int)len - 1 - (int)num_offset_bytes);
+			}
+
+			void literals( const BYTE* p, int n )
+			{
+				pending.insert( pending.end(), p, p+n );
+			}
+
+			void copy( unsigned int delta, unsigned int len )
+			{
+				unsigned int extra = len - MIN_MATCH;
+				write_sequence( std::min( extra, NIBBLE_MAX ) );
+				for( unsigned int b = 0; b < num_offset_bytes; b++ )
+					data.push_back( (delta >> (8*b)) & 0xff );
+				if( extra >= NIBBLE_MAX )
+					write_extra_len( data, extra - NIBBLE_MAX );
+			}
+
+			void clear()
+			{
+				data.clear();
+				pending.clear();
+			}
+
+			//----------------------------------------
+			//  The block's payload, good until the next clear()
+			//----------------------------------------
+			const std::vector<BYTE>& finish()
+			{
+				if( !pending.empty() )
+					write_sequence( 0 );
+				return data;
+			}
+	};
+
+	//----------------------------------------
+	//  Decodes the len bytes of sequences at p onto the end of out, which should come to out_end bytes.
+	//	window_bits is what the deltas were written with. Returns false if they're corrupt. Either way out is cut
+	//	back to what was decoded, so a block that decodes short is left for the caller to notice.
+	//----------------------------------------
+	inline bool decode( const BYTE* p, size_t len, std::vector<BYTE>& out, size_t out_end, unsigned int window_bits )
+	{
+		const BYTE* end = p + len;
+		unsigned int num_offset_bytes = offset_bytes( window_bits );
+
+		// write straight into the space the block will fill
+		size_t pos = out.size();
+		out.resize( out_end );
+		BYTE* base = out.data();
+
+		bool corrupt = false;
+		while( p < end && !corrupt )
+		{
+			BYTE token = *p++;
+
+			size_t num_literals = token >> 4;
+			if( num_literals == NIBBLE_MAX && !read_extra_len( p, end, num_literals ) )
+				corrupt = true;
+			else if( num_literals > (size_t)(end - p) || num_literals > out_end - pos )
+				corrupt = true;
+			if( corrupt )
+				break;
+			if( num_literals <= 2*CHUNK && (size_t)(end - p) >= 2*CHUNK && out_end - pos >= 2*CHUNK )
+				// a fixed size copy is a couple of moves instead of a call. What it runs over gets written again later.
+				memcpy( base + pos, p, 2*CHUNK );
+			else
+				memcpy( base + pos, p, num_literals );
+			p += num_literals;
+			pos += num_literals;
+
+			if( p == end )
+				// the last sequence has no copy
+				break;
+
+			size_t delta = 0;
+			size_t copy_len = token & NIBBLE_MAX;
+			if( (size_t)(end - p) < num_offset_bytes )
+				corrupt = true;
+			else
+			{
+				for( unsigned int b = 0; b < num_offset_bytes; b++ )
+					delta |= (size_t)p[b] << (8*b);
+				p += num_offset_bytes;
+				if( copy_len == NIBBLE_MAX && !read_extra_len( p, end, copy_len ) )
+					corrupt = true;
+			}
+			copy_len += MIN_MATCH;
+			if( corrupt || delta >= pos || copy_len > out_end - pos )
+			{
+				corrupt = true;
+				break;
+			}
+
+			copy_match( base, pos, delta, copy_len, out_end );
+			pos += copy_len;
+		}
+
+		out.resize( pos );
+		return !corrupt;
+	}
+}
+
+#endif /* end of include guard: __TOKENFORMAT_HEADER_GUARD__ */
@@ -0,0 +1,241 @@
+//----------------------------------------
+//  A work-stealing pool of threads, for jobs of very different sizes (whole files, and pieces of big ones).
+//	Every thread has its own deque of tasks. It pushes the tasks it spawns onto the back and takes its next one
+//	from the back too, so it finishes what it started first. A thread with nothing left steals from the front of
+//	someone else's deque, which is where the oldest and usually biggest tasks are.
+//	Tasks are grouped, and wait() on a group keeps running tasks until all of that group's are done, so a task
+//	that splits itself up and waits for the pieces helps with them instead of blocking a thread.
+//	The deques are plain locked std::deques: tasks here are whole blocks of compression, so contention is low.
+//----------------------------------------
+
+#ifndef __WORKERPOOL_HEADER_GUARD__
+#define __WORKERPOOL_HEADER_GUARD__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+//----------------------------------------
+//  How many threads to use when the user doesn't say
+//----------------------------------------
+inline int default_num_threads()
+{
+	return std::max( 1, (int)std::thread::hardware_concurrency() );
+}
+
+class WorkerPool
+{
+	public:
+
+		//----------------------------------------
+		//  Tasks that can be waited for together
+		//----------------------------------------
+		class TaskGroup
+		{
+			friend class WorkerPool;
+
+			private:
+
+				std::atomic<int> pending;
+
+			public:
+
+				TaskGroup() :
+					pending( 0 )
+				{
+				}
+		};
+
+	private:
+
+		typedef std::function<void()> Task;
+
+		struct Entry
+		{
+			Task task;
+			TaskGroup* group;
+		};
+
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Entry> entries;
+		};
+
+		// one per thread, including the one that made the pool (queue 0)
+		std::vector<Queue*> queues;
+		std::vector<std::thread> threads;
+
+		std::atomic<bool> stopping;
+		std::atomic<int> num_queued;
+		// where tasks spawned from threads outside the pool go
+		std::atomic<unsigned int> next_outside;
+
+		std::mutex sleep_mutex;
+		std::condition_variable wake;
+
+		//----------------------------------------
+		//  The index of the calling thread's queue in this pool, or -1 if it isn't one of ours
+		//----------------------------------------
+		int my_index() const
+		{
+			if( current_pool() == this )
+				return current_index();
+			if( std::this_thread::get_id() == owner )
+				return 0;
+			return -1;
+		}
+
+		std::thread::id owner;
+
+		static const WorkerPool*& current_pool()
+		{
+			static thread_local const WorkerPool* pool = NULL;
+			return pool;
+		}
+
+		static int& current_index()
+		{
+			static thread_local int index = -1;
+			return index;
+		}
+
+		bool pop( int q, bool from_back, Entry& entry )
+		{
+			Queue& queue = *queues[q];
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if( queue.entries.empty() )
+				return false;
+			if( from_back )
+			{
+				entry = queue.entries.back();
+				queue.entries.pop_back();
+			}
+			else
+			{
+				entry = queue.entries.front();
+				queue.entries.pop_front();
+			}
+			num_queued--;
+			return true;
+		}
+
+		//----------------------------------------
+		//  Runs one task, our own newest if there is one, or else one stolen from another queue.
+		//	Returns false if there was nothing to do.
+		//----------------------------------------
+		bool run_one( int self )
+		{
+			Entry entry;
+			bool found = self >= 0 && pop( self, true, entry );
+			for( int k = 1; !found && k <= (int)queues.size(); k++ )
+			{
+				int victim = (std::max( self, 0 ) + k) % queues.size();
+				found = pop( victim, false, entry );
+			}
+			if( !found )
+				return false;
+
+			entry.task();
+			if( --entry.group->pending == 0 )
+			{
+				// whoever's waiting on the group can go
+				std::lock_guard<std::mutex> lock( sleep_mutex );
+				wake.notify_all();
+			}
+			return true;
+		}
+
+		void worker( int index )
+		{
+			current_pool() = this;
+			current_index() = index;
+			while( !stopping )
+			{
+				if( run_one( index ) )
+					continue;
+
+				std::unique_lock<std::mutex> lock( sleep_mutex );
+				wake.wait_for( lock, std::chrono::milliseconds( 10 ), [this]() { return stopping || num_queued > 0; } );
+			}
+		}
+
+	public:
+
+		//----------------------------------------
+		//  num_threads counts the calling thread, which works on tasks while it's in wait()
+		//----------------------------------------
+		WorkerPool( int num_threads ) :
+			stopping( false ),
+			num_queued( 0 ),
+			next_outside( 0 ),
+			owner( std::this_thread::get_id() )
+		{
+			num_threads = std::max( num_threads, 1 );
+			for( int t = 0; t < num_threads; t++ )
+				queues.push_back( new Queue() );
+			for( int t = 1; t < num_threads; t++ )
+				threads.push_back( std::thread( &WorkerPool::worker, this, t ) );
+		}
+
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock( sleep_mutex );
+				stopping = true;
+				wake.notify_all();
+			}
+			for( size_t t = 0; t < threads.size(); t++ )
+				threads[t].join();
+			for( size_t q = 0; q < queues.size(); q++ )
+				delete queues[q];
+		}
+
+		int num_threads() const { return queues.size(); }
+
+		//----------------------------------------
+		//  Queues task as part of group. It may run on any thread, and already have by the time this returns.
+		//----------------------------------------
+		void spawn( TaskGroup& group, const Task& task )
+		{
+			group.pending++;
+
+			int q = my_index();
+			if( q < 0 )
+				q = next_outside++ % queues.size();
+
+			Entry entry = { task, &group };
+			{
+				std::lock_guard<std::mutex> lock( queues[q]->mutex );
+				queues[q]->entries.push_back( entry );
+				num_queued++;
+			}
+
+			std::lock_guard<std::mutex> lock( sleep_mutex );
+			wake.notify_one();
+		}
+
+		//----------------------------------------
+		//  Runs tasks until all of group's are done
+		//----------------------------------------
+		void wait( TaskGroup& group )
+		{
+			int self = my_index();
+			while( group.pending > 0 )
+			{
+				if( run_one( self ) )
+					continue;
+
+				std::unique_lock<std::mutex> lock( sleep_mutex );
+				wake.wait_for( lock, std::chrono::milliseconds( 10 ), [&]() { return group.pending == 0 || num_queued > 0; } );
+			}
+		}
+};
+
+#endif /* end of include guard: __WORKERPOOL_HEADER_GUARD__ */
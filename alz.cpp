@@ -1,5 +1,12 @@
 //----------------------------------------
-//  This is the naive "ground truth" implementation, unoptimized greedy
+//  The alz command line: an LZ77 compressor and decompressor.
+//	Compressing runs one of several match finders (see MatchFinder.hpp) block by block, parsing greedily or with
+//	--lazy, and emits each block in one of the formats (the bit stream here, or the byte-aligned tokens, flags and
+//	streams) inside the .alz container (Container.hpp). -1 to -9 pick presets of finder, depth, window and format.
+//	Big inputs are split into pieces compressed on a work-stealing thread pool, and, unless long-range matching or
+//	a reference needs the whole file first, are read, compressed and written as a pipeline.
+//	Decompressing reads any of the block types, and the original headerless bit stream.
+//	There are also batch mode, for many files at once, dictionaries (-D, -r) and training them.
 //----------------------------------------
 
 //#define VERBOSE
@@ -7,18 +14,70 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
 
 #include "BitWriter.hpp"
 #include "BitReader.hpp"
-#include "SuffixTree.hpp"
+#include "MatchFinder.hpp"
+#include "Stats.hpp"
+#include "Container.hpp"
+#include "LongRange.hpp"
+#include "Dictionary.hpp"
+#include "FileIO.hpp"
+#include "WorkerPool.hpp"
+#include "Pipeline.hpp"
+#include "TokenFormat.hpp"
+#include "FlagFormat.hpp"
+#include "StreamFormat.hpp"
 
+// The delta field width of the headerless format and of version 1 containers.
+// Newer containers say how big their window is, and if it's wider than this, each delta gets a bit saying
+// whether it's near (and NUM_DELTA_BITS wide) or far (and as wide as the window), so nearby copies stay cheap.
 static const unsigned int NUM_DELTA_BITS = 12;
 static const unsigned int NUM_LEN_BITS = 4;
 
-inline unsigned int get_max_delta()
+// Copies longer than get_max_copy_len() store 0 in the length field, and the real length is get_max_copy_len()+1
+// plus a sequence of LONG_LEN_BITS-bit extra lengths, where an all-ones extra means there's another one after it.
+// A copy may overlap the bytes it produces, so one with delta 0 repeats the previous byte, ie. it's a run.
+static const unsigned int LONG_LEN_BITS = 8;
+
+// How far the finders compare, except the suffix tree. A match that gets this far is extended by the compressor.
+static const int MAX_SEARCH_LEN = 256;
+
+// Inputs are compressed in separate pieces of at least this many bytes, and this many windows,
+// so different threads can work on them
+static const int MIN_PIECE_SIZE = 1 << 20;
+static const int PIECE_WINDOWS = 8;
+
+inline int get_piece_size( unsigned int window_bits )
+{
+	return std::max( (int64_t)MIN_PIECE_SIZE, (int64_t)PIECE_WINDOWS << window_bits );
+}
+
+// In fast mode, after this many literals in a row (in log2) we start searching only every other position,
+// then every third, and so on, up to MAX_MISS_STEP
+static const unsigned int MISS_SHIFT = 5;
+static const unsigned int MAX_MISS_STEP = 32;
+// Short copies are as likely to be noise as not, so they count as misses too, and it takes a copy at least
+// this long to reset the count
+static const int MIN_HIT_LEN = 4;
+
+// Blocks that look random are only searched PROBE_LEN bytes in every PROBE_STRIDE, until one of those is mostly copies
+static const int PROBE_LEN = 64;
+static const int PROBE_STRIDE = 4096;
+
+// With lazy parsing, copies at least this long are taken without looking at the next position
+static const int LAZY_GOOD_LEN = 32;
+
+inline unsigned int get_max_delta( unsigned int delta_bits = NUM_DELTA_BITS )
 {
 	// subtract one, since we want inclusive max
-	return (1 << NUM_DELTA_BITS) - 1;
+	return (1 << delta_bits) - 1;
 }
 
 inline unsigned int get_max_copy_len()
@@ -29,170 +88,924 @@ inline unsigned int get_max_copy_len()
 using namespace std;
 
 //----------------------------------------
-//  Naive approach
+//  How many bits write_copy_delta() takes for this delta
 //----------------------------------------
-int find_longest_match( const vector<BYTE>& pile, int pile_start, int pile_end, const vector<BYTE>& target, int& best_len )
+inline unsigned int get_delta_cost( unsigned int delta, unsigned int window_bits )
 {
-	assert( pile_end <= pile.size() );
+	if( window_bits <= NUM_DELTA_BITS )
+		return window_bits;
+	return 1 + (delta <= get_max_delta() ? NUM_DELTA_BITS : window_bits);
+}
 
-	int best_match = -1;
-	best_len = -1;
-	for( int i = pile_start; i < pile_end; i++ )
+//----------------------------------------
+//  Whether a copy is cheaper than writing its bytes as literals, at 9 bits each.
+//	Only short ones from far away aren't. Long lengths cost more bits, but by then the copy is well ahead.
+//----------------------------------------
+inline bool copy_pays( unsigned int delta, unsigned int len, unsigned int window_bits )
+{
+	return 1 + get_delta_cost( delta, window_bits ) + NUM_LEN_BITS < 9*len;
+}
+
+//----------------------------------------
+//  How many bits a copy saves over writing its bytes as literals, by the same reckoning as copy_pays()
+//----------------------------------------
+inline int copy_saving( unsigned int delta, unsigned int len, unsigned int window_bits )
+{
+	return 9*len - (1 + get_delta_cost( delta, window_bits ) + NUM_LEN_BITS);
+}
+
+//----------------------------------------
+//  Writes a copy's delta field, with the near / far bit if the window is wider than NUM_DELTA_BITS
+//----------------------------------------
+inline void write_copy_delta( BitWriter& bw, unsigned int delta, unsigned int window_bits )
+{
+	if( window_bits <= NUM_DELTA_BITS )
+		bw.write_bits( delta, window_bits );
+	else if( delta <= get_max_delta() )
+	{
+		bw.write_bit( 0 );
+		bw.write_bits( delta, NUM_DELTA_BITS );
+	}
+	else
+	{
+		bw.write_bit( 1 );
+		bw.write_bits( delta, window_bits );
+	}
+}
+
+//----------------------------------------
+//  Reads what write_copy_delta() wrote. Returns false if the bits ran out.
+//----------------------------------------
+inline bool read_copy_delta( BitReader& br, size_t& delta, unsigned int window_bits )
+{
+	delta = 0;
+	if( window_bits <= NUM_DELTA_BITS )
+		return br.read_bits( delta, window_bits );
+
+	bool far = false;
+	if( !br.read_bit( far ) )
+		return false;
+	return br.read_bits( delta, far ? window_bits : NUM_DELTA_BITS );
+}
+
+//----------------------------------------
+//  Writes a copy's length field, with the long length escape if needed
+//----------------------------------------
+inline void write_copy_len( BitWriter& bw, unsigned int len )
+{
+	if( len <= get_max_copy_len() )
 	{
-		int curr_len = 0;
-		for( int j = 0; j < target.size() && (i+j) < pile_end; j++ )
+		bw.write_bits( len, NUM_LEN_BITS );
+		return;
+	}
+
+	bw.write_bits( 0, NUM_LEN_BITS );
+	unsigned int extra = len - get_max_copy_len() - 1;
+	unsigned int all_ones = (1 << LONG_LEN_BITS) - 1;
+	while( extra >= all_ones )
+	{
+		bw.write_bits( all_ones, LONG_LEN_BITS );
+		extra -= all_ones;
+	}
+	bw.write_bits( extra, LONG_LEN_BITS );
+}
+
+//----------------------------------------
+//  Reads what write_copy_len() wrote. Returns false if the bits ran out.
+//----------------------------------------
+inline bool read_copy_len( BitReader& br, size_t& len )
+{
+	len = 0;
+	if( !br.read_bits( len, NUM_LEN_BITS ) )
+		return false;
+	if( len != 0 )
+		return true;
+
+	len = get_max_copy_len() + 1;
+	size_t all_ones = (1 << LONG_LEN_BITS) - 1;
+	while( true )
+	{
+		size_t extra = 0;
+		if( !br.read_bits( extra, LONG_LEN_BITS ) )
+			return false;
+		len += extra;
+		if( extra != all_ones )
+			return true;
+	}
+}
+
+//----------------------------------------
+//  Where compress_block() sends its literals and copies: the original bit stream, for a BLOCK_BITS block.
+//	The other block formats have emitters with the same members (see TokenFormat.hpp). Each one also says
+//	what a copy saves in its format, so the parser only makes the copies that pay there.
+//----------------------------------------
+class BitEmitter
+{
+	private:
+
+		BitWriter bw;
+		unsigned int window_bits;
+
+	public:
+
+		static const container::BlockType BLOCK_TYPE = container::BLOCK_BITS;
+
+		BitEmitter( unsigned int _window_bits ) :
+			window_bits( _window_bits )
 		{
-			if( pile[i+j] == target[j] )
-				curr_len++;
+		}
+
+		bool copy_pays( unsigned int delta, unsigned int len ) const { return ::copy_pays( delta, len, window_bits ); }
+		int copy_saving( unsigned int delta, unsigned int len ) const { return ::copy_saving( delta, len, window_bits ); }
+
+		void literals( const BYTE* p, int n )
+		{
+			for( int j = 0; j < n; j++ )
+				// flag 0, then the byte
+				bw.write_bits( (unsigned int)p[j] << 1, 9 );
+		}
+
+		void copy( unsigned int delta, unsigned int len )
+		{
+			bw.write_bit( 1 );
+			write_copy_delta( bw, delta, window_bits );
+			write_copy_len( bw, len );
+		}
+
+		void clear() { bw.clear(); }
+
+		//----------------------------------------
+		//  The block's payload, good until the next clear()
+		//----------------------------------------
+		const vector<BYTE>& finish() { return bw.get_bytes(); }
+};
+
+//----------------------------------------
+//  With a wide window, far copies cost more than near ones, so the longest match isn't always the best.
+//	This picks whichever of the finder's matches at position i saves the most bits over literals in emitter's format.
+//----------------------------------------
+template <class Finder, class Emitter>
+Match pick_cheapest( Finder& finder, const vector<BYTE>& target, int min_pos, int i, const Emitter& emitter, vector<Match>& matches, size_t* num_steps )
+{
+	finder.find_all( target, min_pos, matches, num_steps );
+
+	Match best( -1, 0 );
+	int best_saving = 0;
+	for( size_t m = 0; m < matches.size(); m++ )
+	{
+		int saving = emitter.copy_saving( i - matches[m].first - 1, matches[m].second );
+		// later matches are longer, so on a tie they're more likely to extend past the target
+		if( saving >= best_saving )
+		{
+			best = matches[m];
+			best_saving = saving;
+		}
+	}
+	return best;
+}
+
+//----------------------------------------
+//  The best copy for the bytes at i, where the finder must be: its match, extended as far as it goes,
+//	or a run of the previous byte if that's longer. (-1, 0) if neither is worth making in emitter's format.
+//----------------------------------------
+template <class Finder, class Emitter>
+Match find_copy( const vector<BYTE>& bytes, int i, int end, Finder& finder, unsigned int window_bits, const Emitter& emitter,
+		vector<BYTE>& target, vector<Match>& matches, Stats* stats )
+{
+	int max_search_len = finder.get_max_search_len();
+
+	// copy the next target chunk
+	int target_len = min( max_search_len, end-i );
+	target.assign( &bytes[i], &bytes[i] + target_len );
+
+	// Is this a run of the previous byte? Comparing against the bytes one back finds out how long.
+	int run_len = i > 0 ? match_length( &bytes[i], &bytes[i-1], end-i ) : 0;
+
+	int longest_match = -1;
+	int best_len = 0;
+	if( run_len <= max_search_len )
+	{
+		// search for it in previous bytes
+		// but only look back as far as the window goes
+		// (a longer run would beat anything the finder can come up with, so don't bother then)
+		int pile_start = max( (int)0, (int)(i-get_max_delta( window_bits )-1) );
+		size_t num_steps = 0;
+		Match match;
+		{
+			ScopedTimer t( stats ? &stats->search_secs : NULL );
+			if( window_bits <= NUM_DELTA_BITS )
+				match = finder.find_best( target, pile_start, stats ? &num_steps : NULL );
+			else
+				match = pick_cheapest( finder, target, pile_start, i, emitter, matches, stats ? &num_steps : NULL );
+		}
+		longest_match = match.first;
+		best_len = match.second;
+		if( stats )
+			stats->add_search( num_steps );
+
+		// The finder only looks so far, so see if the match keeps going.
+		// It may run on into the bytes the copy itself produces.
+		if( best_len >= 2 )
+			best_len += match_length( &bytes[longest_match+best_len], &bytes[i+best_len], end-i-best_len );
+	}
+
+	if( run_len >= 2 && run_len > best_len )
+	{
+		// copy from one byte back, ie. delta 0
+		longest_match = i-1;
+		best_len = run_len;
+	}
+
+	if( best_len >= 2 && emitter.copy_pays( i - longest_match - 1, best_len ) )
+		return Match( longest_match, best_len );
+	return Match( -1, 0 );
+}
+
+//----------------------------------------
+//  The main compression loop, for the bytes in [start, end). Parsing is greedy, or with opts.lazy, a copy
+//	is put off by a literal whenever the next position has a better one, as in zlib.
+//	Copies never run past end, so the block decodes to exactly end-start bytes.
+//	Templated on the finder and the emitter (the block format) so the calls into them are devirtualised.
+//	Returns how many of the bytes went into copies.
+//----------------------------------------
+template <class Finder, class Emitter>
+int compress_block( const vector<BYTE>& bytes, int start, int end, Finder& finder, const CompressOptions& opts, Emitter& emitter, Stats* stats )
+{
+	vector<BYTE> target( finder.get_max_search_len() );
+	// literals in a row so far
+	int misses = 0;
+
+	unsigned int window_bits = opts.window_bits;
+	vector<Match> matches;
+
+	// a copy already found for i, by looking ahead from i-1
+	Match pending( -1, 0 );
+	int copied = 0;
+
+	for( int i = start; i < end; )
+	{
+		Match copy = pending.second > 0 ? pending : find_copy( bytes, i, end, finder, window_bits, emitter, target, matches, stats );
+		pending = Match( -1, 0 );
+
+		// whether the finder's already past i
+		bool looked_ahead = false;
+		if( opts.lazy && copy.second > 0 && copy.second < LAZY_GOOD_LEN && i+1 < end )
+		{
+			{
+				ScopedTimer t( stats ? &stats->update_secs : NULL );
+				finder.advance( 1 );
+			}
+			looked_ahead = true;
+
+			Match next = find_copy( bytes, i+1, end, finder, window_bits, emitter, target, matches, stats );
+			if( next.second > 0 && emitter.copy_saving( i - next.first, next.second ) > emitter.copy_saving( i - copy.first - 1, copy.second ) )
+			{
+				// better to start one later, so this one's a literal
+				{
+					ScopedTimer t( stats ? &stats->emit_secs : NULL );
+					emitter.literals( &bytes[i], 1 );
+				}
+				if( stats )
+					stats->add_literals( 1 );
+				i++;
+				pending = next;
+				continue;
+			}
+		}
+
+		if( copy.second > 0 )
+		{
+			// compress it!
+			int best_len = copy.second;
+			unsigned int delta = i - copy.first - 1;
+			{
+				ScopedTimer t( stats ? &stats->emit_secs : NULL );
+				emitter.copy( delta, best_len );
+			}
+			if( stats )
+				stats->add_copy( delta, best_len );
+#ifdef VERBOSE
+			cout << "copy " << delta << " " << best_len << endl;
+#endif
+
+			// advance cursor past the length, and the finder with it
+			i += best_len;
+			copied += best_len;
+			if( best_len >= MIN_HIT_LEN )
+				misses = 0;
+			else
+				// a short copy is as much a miss as a literal
+				misses++;
+			int remaining = looked_ahead ? best_len-1 : best_len;
+			ScopedTimer t( stats ? &stats->update_secs : NULL );
+			if( opts.fast )
+				finder.skip( remaining );
 			else
+				finder.advance( remaining );
+		}
+		else
+		{
+			// didn't find any. just output it
+			// and in fast mode, maybe a few more without looking
+			int num_literals = 1;
+			if( opts.fast )
+			{
+				misses++;
+				num_literals = min( min( 1 + (misses >> MISS_SHIFT), (int)MAX_MISS_STEP ), end-i );
+			}
+
+			{
+				ScopedTimer t( stats ? &stats->emit_secs : NULL );
+				emitter.literals( &bytes[i], num_literals );
+			}
+			if( stats )
+				stats->add_literals( num_literals );
+#ifdef VERBOSE
+			for( int j = 0; j < num_literals; j++ )
+				cout << "byte " << bytes[i+j] << endl;
+#endif
+
+			// advance cursor and finder
+			i += num_literals;
+			ScopedTimer t( stats ? &stats->update_secs : NULL );
+			finder.advance( 1 );
+			if( num_literals > 1 )
+				finder.skip( num_literals-1 );
+		}
+	}
+	return copied;
+}
+
+//----------------------------------------
+//  compress_block() for a block that looks random. Searching all of it would mostly be wasted, but it may
+//	repeat something earlier (a compressed file twice, say), so every PROBE_STRIDE bytes the first PROBE_LEN
+//	are searched, and the rest skipped over as literals. Once a probe is mostly copies, the rest of the block is
+//	compressed as usual. (Random data has plenty of short matches by chance, so any copy at all won't do.)
+//	Returns how many bytes went into copies.
+//----------------------------------------
+template <class Finder, class Emitter>
+int probe_block( const vector<BYTE>& bytes, int start, int end, Finder& finder, const CompressOptions& opts, Emitter& emitter, Stats* stats )
+{
+	for( int i = start; i < end; )
+	{
+		int probe_end = min( i + PROBE_LEN, end );
+		int copied = compress_block( bytes, i, probe_end, finder, opts, emitter, stats );
+		i = probe_end;
+		if( copied >= PROBE_LEN/2 )
+			return copied + compress_block( bytes, i, end, finder, opts, emitter, stats );
+
+		int gap = min( i + PROBE_STRIDE - PROBE_LEN, end ) - i;
+		{
+			ScopedTimer t( stats ? &stats->emit_secs : NULL );
+			emitter.literals( &bytes[i], gap );
+		}
+		if( stats )
+			stats->add_literals( gap );
+		i += gap;
+		ScopedTimer t( stats ? &stats->update_secs : NULL );
+		finder.skip( gap );
+	}
+	return 0;
+}
+
+//----------------------------------------
+//  compress_block() for the hash table, where it's all about speed: one probe per position straight into
+//	the table, no target to copy out, and literals handed over in runs.
+//	Fast mode skips positions between probes as above, which on incompressible stretches is most of them.
+//----------------------------------------
+template <class Emitter>
+int compress_block( const vector<BYTE>& bytes, int start, int end, HashTableFinder& finder, const CompressOptions& opts, Emitter& emitter, Stats* stats )
+{
+	int misses = 0;
+	int copied = 0;
+
+	for( int i = start; i < end; )
+	{
+		int src = finder.exchange();
+		if( stats )
+			stats->add_search( 1 );
+
+		// the table's match is good for MIN_LEN bytes, if they're all before end
+		int len = 0;
+		if( src >= 0 && i + HashTable::MIN_LEN <= end )
+			len = HashTable::MIN_LEN + match_length( &bytes[src+HashTable::MIN_LEN], &bytes[i+HashTable::MIN_LEN], end-i-HashTable::MIN_LEN );
+
+		if( len > 0 && emitter.copy_pays( i - src - 1, len ) )
+		{
+			unsigned int delta = i - src - 1;
+			emitter.copy( delta, len );
+			if( stats )
+				stats->add_copy( delta, len );
+
+			i += len;
+			copied += len;
+			misses = 0;
+			finder.skip( len-1 );
+		}
+		else
+		{
+			int num_literals = 1;
+			if( opts.fast )
+			{
+				misses++;
+				num_literals = min( min( 1 + (misses >> MISS_SHIFT), (int)MAX_MISS_STEP ), end-i );
+			}
+
+			emitter.literals( &bytes[i], num_literals );
+			if( stats )
+				stats->add_literals( num_literals );
+
+			i += num_literals;
+			if( num_literals > 1 )
+				finder.skip( num_literals-1 );
+		}
+	}
+	return copied;
+}
+
+//----------------------------------------
+//  Compresses chars from history_len on into container blocks, one block at a time, appended to out.
+//	The bytes before that are history: the finder indexes them first, and copies may reach back into them.
+//	Blocks that look random are only probed for repeats (see probe_block()), and any block that doesn't come out smaller is stored raw,
+//	so the output can never grow by more than the block headers.
+//	long_matches become copy blocks, and the rest is blocked up around them. Their pos is relative to chars,
+//	but src is where the decoder will have the bytes.
+//----------------------------------------
+template <class Finder, class Emitter>
+void compress_blocks( const vector<BYTE>& chars, int history_len, Finder& finder, Emitter& emitter, const CompressOptions& opts,
+		const vector<long_range::LongMatch>& long_matches, vector<BYTE>& out, Stats* stats )
+{
+	{
+		PROFILE_SCOPE( "index_history" );
+		ScopedTimer t( stats ? &stats->update_secs : NULL );
+		finder.advance( history_len );
+	}
+	size_t next_long = 0;
+
+	for( int start = history_len; start < (int)chars.size(); )
+	{
+		if( next_long < long_matches.size() && long_matches[next_long].pos == start )
+		{
+			const long_range::LongMatch& m = long_matches[next_long++];
+			container::write_copy_block( out, m.len, m.src );
+			if( stats )
+				stats->add_long_match( m.len );
+			start += m.len;
+
+			ScopedTimer t( stats ? &stats->update_secs : NULL );
+			finder.skip( m.len );
+			continue;
+		}
+
+		int end = min( start + container::BLOCK_SIZE, (int)chars.size() );
+		if( next_long < long_matches.size() )
+			end = min( end, long_matches[next_long].pos );
+		int raw_len = end - start;
+
+		emitter.clear();
+		{
+			PROFILE_SCOPE( "compress_block" );
+			if( container::looks_incompressible( &chars[start], raw_len ) )
+				probe_block( chars, start, end, finder, opts, emitter, stats );
+			else
+				compress_block( chars, start, end, finder, opts, emitter, stats );
+		}
+		PROFILE_SCOPE( "emit" );
+		const vector<BYTE>& payload = emitter.finish();
+		bool stored = payload.size() >= (size_t)raw_len;
+
+		ScopedTimer t( stats ? &stats->emit_secs : NULL );
+		if( stored )
+			container::write_block( out, container::BLOCK_STORED, raw_len, &chars[start], raw_len );
+		else
+			container::write_block( out, Emitter::BLOCK_TYPE, raw_len, payload.data(), payload.size() );
+
+		if( stats )
+			stats->add_block( stored, raw_len );
+		start = end;
+	}
+
+	if( stats )
+		finder.add_stats( *stats );
+}
+
+//----------------------------------------
+//  compress_blocks() in the block format opts asks for
+//----------------------------------------
+template <class Finder>
+void compress_blocks( const vector<BYTE>& chars, int history_len, Finder& finder, const CompressOptions& opts,
+		const vector<long_range::LongMatch>& long_matches, vector<BYTE>& out, Stats* stats )
+{
+	switch( opts.format )
+	{
+		case FORMAT_BITS:
+		{
+			BitEmitter emitter( opts.window_bits );
+			compress_blocks( chars, history_len, finder, emitter, opts, long_matches, out, stats );
+			break;
+		}
+		case FORMAT_TOKENS:
+		{
+			token_format::Emitter emitter( opts.window_bits );
+			compress_blocks( chars, history_len, finder, emitter, opts, long_matches, out, stats );
+			break;
+		}
+		case FORMAT_FLAGS:
+		{
+			flag_format::Emitter emitter( opts.window_bits );
+			compress_blocks( chars, history_len, finder, emitter, opts, long_matches, out, stats );
+			break;
+		}
+		case FORMAT_STREAMS:
+		{
+			stream_format::Emitter emitter( opts.window_bits );
+			compress_blocks( chars, history_len, finder, emitter, opts, long_matches, out, stats );
+			break;
+		}
+		default:
+			assert( false );
+	}
+}
+
+//----------------------------------------
+//  compress_blocks() with the finder opts asks for
+//----------------------------------------
+void compress_piece( const vector<BYTE>& chars, int history_len, const CompressOptions& opts,
+		const vector<long_range::LongMatch>& long_matches, vector<BYTE>& out, Stats* stats )
+{
+	// the finders size their structures by the window, which needn't be any bigger than the input
+	int window = min( (size_t)get_max_delta( opts.window_bits )+1, chars.size()+1 );
+
+	switch( opts.engine )
+	{
+		case ENGINE_BRUTE_FORCE:
+		{
+			BruteForceFinder finder( chars, MAX_SEARCH_LEN );
+			compress_blocks( chars, history_len, finder, opts, long_matches, out, stats );
+			break;
+		}
+		case ENGINE_SUFFIX_TREE:
+		{
+			// it updates this many suffixes per byte, so stick to what fits in the length field
+			SuffixTreeFinder finder( chars, get_max_copy_len() );
+			compress_blocks( chars, history_len, finder, opts, long_matches, out, stats );
+			break;
+		}
+		case ENGINE_BINARY_TREE:
+		{
+			BinaryTreeFinder finder( chars, MAX_SEARCH_LEN, window, opts.search_depth > 0 ? opts.search_depth : (int)BinaryTree::DEFAULT_MAX_DEPTH );
+			compress_blocks( chars, history_len, finder, opts, long_matches, out, stats );
+			break;
+		}
+		case ENGINE_SUFFIX_ARRAY:
+		{
+			SuffixArrayFinder finder( chars, MAX_SEARCH_LEN, window );
+			compress_blocks( chars, history_len, finder, opts, long_matches, out, stats );
+			break;
+		}
+		case ENGINE_HASH_TABLE:
+		{
+			HashTableFinder finder( chars, MAX_SEARCH_LEN, window );
+			compress_blocks( chars, history_len, finder, opts, long_matches, out, stats );
+			break;
+		}
+		default:
+			assert( false );
+	}
+}
+
+//----------------------------------------
+//  Compresses bytes from history_len on into a container in out. The bytes before that are a dictionary,
+//	which the decoder is told to expect.
+//	Inputs bigger than a piece are cut into pieces that are compressed separately, on pool's threads if there
+//	is a pool. Each piece starts by indexing the window before it, so it can still find everything the window
+//	reaches, and the pieces' blocks go out in order. Where the cuts go depends only on the input and options,
+//	so the output is the same however many threads there are.
+//----------------------------------------
+void compress_with_engine( const vector<BYTE>& bytes, int history_len, const CompressOptions& given_opts, vector<BYTE>& out, Stats* stats, WorkerPool* pool )
+{
+	// a reference file may need a wider window
+	CompressOptions opts( given_opts );
+	if( opts.reference )
+	{
+		// wide enough that the start of the reference is still in reach at the end of the input
+		while( opts.window_bits < container::MAX_WINDOW_BITS && get_max_delta( opts.window_bits ) < bytes.size() )
+			opts.window_bits++;
+		opts.long_range = true;
+	}
+
+	container::write_header( out, opts.window_bits );
+	if( history_len > 0 )
+	{
+		vector<BYTE> dict( bytes.begin(), bytes.begin() + history_len );
+		container::write_dict_block( out, history_len, dictionary::checksum( dict ) );
+	}
+
+	vector<long_range::LongMatch> long_matches;
+	if( opts.long_range )
+	{
+		ScopedTimer t( stats ? &stats->search_secs : NULL );
+		// normally just the ones the window can't reach, but against a reference, the long ones are most of the file
+		// and taking them whole is much faster than parsing through them
+		int min_distance = opts.reference ? 0 : get_max_delta( opts.window_bits )+1;
+		long_range::find_long_matches( bytes, history_len, min_distance, long_matches );
+	}
+
+	// Cut it up. A long match is a block of its own anyway, so never cut through one.
+	int window = get_max_delta( opts.window_bits )+1;
+	int piece_size = get_piece_size( opts.window_bits );
+	vector<int> cuts( 1, history_len );
+	size_t next_long = 0;
+	while( (int)bytes.size() - cuts.back() > piece_size )
+	{
+		int cut = cuts.back() + piece_size;
+		while( next_long < long_matches.size() && long_matches[next_long].pos + long_matches[next_long].len <= cut )
+			next_long++;
+		if( next_long < long_matches.size() && long_matches[next_long].pos < cut )
+			cut = long_matches[next_long].pos + long_matches[next_long].len;
+		if( cut >= (int)bytes.size() )
+			break;
+		cuts.push_back( cut );
+	}
+	cuts.push_back( bytes.size() );
+	int num_pieces = cuts.size() - 1;
+
+	if( num_pieces == 1 && history_len <= window )
+	{
+		// nothing to cut off
+		compress_piece( bytes, history_len, opts, long_matches, out, stats );
+		container::write_end( out );
+		return;
+	}
+
+	vector< vector<BYTE> > piece_out( num_pieces );
+	vector<Stats> piece_stats( stats ? num_pieces : 0 );
+
+	auto do_piece = [&]( int p )
+	{
+		// each piece gets its own copy of the bytes it covers and the window before it
+		int hist_start = max( 0, cuts[p] - window );
+		vector<BYTE> chars( bytes.begin() + hist_start, bytes.begin() + cuts[p+1] );
+
+		vector<long_range::LongMatch> piece_long;
+		for( size_t m = 0; m < long_matches.size(); m++ )
+		{
+			if( long_matches[m].pos >= cuts[p] && long_matches[m].pos < cuts[p+1] )
+			{
+				piece_long.push_back( long_matches[m] );
+				piece_long.back().pos -= hist_start;
+			}
+		}
+
+		compress_piece( chars, cuts[p] - hist_start, opts, piece_long, piece_out[p], stats ? &piece_stats[p] : NULL );
+	};
+
+	if( pool == NULL )
+	{
+		for( int p = 0; p < num_pieces; p++ )
+			do_piece( p );
+	}
+	else
+	{
+		WorkerPool::TaskGroup group;
+		for( int p = 0; p < num_pieces; p++ )
+			pool->spawn( group, [&do_piece, p]() { do_piece( p ); } );
+		pool->wait( group );
+	}
+
+	for( int p = 0; p < num_pieces; p++ )
+	{
+		out.insert( out.end(), piece_out[p].begin(), piece_out[p].end() );
+		if( stats )
+			stats->merge( piece_stats[p] );
+	}
+
+	container::write_end( out );
+}
+
+//----------------------------------------
+//  Compression as a pipeline: a reader thread cuts the input into pieces as it reads it, the pool compresses
+//	them as they come, and a writer thread writes their blocks out in order. The queues between the stages are
+//	bounded, so reading, compressing and writing all overlap and only a few pieces are ever in memory.
+//	The pieces are cut just where compress_with_engine() would cut them, so the output is the same.
+//	There's no long distance matching, since that needs the whole input.
+//----------------------------------------
+int compress_stream( const string& infile, const string& outfile, const CompressOptions& opts, const vector<BYTE>& dict, Stats* stats )
+{
+	file_io::InputFile fin( infile );
+	if( !fin.good() )
+	{
+		std::cerr << "** Could not open file for read '" << infile << "'" << std::endl;
+		return 1;
+	}
+	file_io::OutputFile fout( outfile );
+	if( !fout.good() )
+	{
+		std::cerr << "** Could not open file for write '" << outfile << "'" << std::endl;
+		return 1;
+	}
+
+	size_t window = get_max_delta( opts.window_bits )+1;
+	size_t piece_size = get_piece_size( opts.window_bits );
+
+	struct Piece
+	{
+		size_t index;
+		// the window before the piece, then the piece
+		vector<BYTE> chars;
+		int history_len;
+	};
+	BoundedQueue<Piece> to_compress( opts.num_threads + 1 );
+	// enough for every thread to have a piece on the go, and the next one read in
+	ReorderBuffer to_write( 2*opts.num_threads + 1 );
+
+	//----------------------------------------
+	//  Read
+	//----------------------------------------
+	size_t bytes_read = 0;
+	bool read_ok = true;
+	double read_secs = 0;
+	std::thread reader( [&]()
+	{
+		vector<BYTE> history( dict.end() - min( dict.size(), window ), dict.end() );
+		for( size_t index = 0; ; index++ )
+		{
+			to_write.wait_for_room( index );
+
+			PROFILE_SCOPE( "load" );
+			Piece piece;
+			piece.index = index;
+			piece.history_len = history.size();
+			piece.chars.resize( history.size() + piece_size );
+			copy( history.begin(), history.end(), piece.chars.begin() );
+			size_t got = 0;
+			{
+				// just the read, not the waits for the other stages
+				ScopedTimer t( stats ? &read_secs : NULL );
+				got = fin.read( &piece.chars[history.size()], piece_size );
+			}
+			if( got == 0 )
 				break;
+
+			piece.chars.resize( history.size() + got );
+			bytes_read += got;
+			history.assign( piece.chars.end() - min( piece.chars.size(), window ), piece.chars.end() );
+			to_compress.push( std::move( piece ) );
+			if( got < piece_size )
+				break;
+		}
+		read_ok = fin.good();
+		to_compress.close();
+	} );
+
+	//----------------------------------------
+	//  Write
+	//----------------------------------------
+	size_t bytes_written = 0;
+	bool write_ok = true;
+	double write_secs = 0;
+	std::thread writer( [&]()
+	{
+		vector<BYTE> data;
+		container::write_header( data, opts.window_bits );
+		if( !dict.empty() )
+			container::write_dict_block( data, dict.size(), dictionary::checksum( dict ) );
+		do
+		{
+			ScopedTimer t( stats ? &write_secs : NULL );
+			PROFILE_SCOPE( "save" );
+			fout.write( data.data(), data.size() );
+			bytes_written += data.size();
+		}
+		while( to_write.take_next( data ) );
+
+		data.clear();
+		container::write_end( data );
+		fout.write( data.data(), data.size() );
+		bytes_written += data.size();
+		write_ok = fout.close();
+	} );
+
+	//----------------------------------------
+	//  Compress, with a thread for each piece in progress. The reader and writer have their own.
+	//----------------------------------------
+	{
+		std::mutex stats_mutex;
+		WorkerPool pool( opts.num_threads + 1 );
+		WorkerPool::TaskGroup group;
+		vector<long_range::LongMatch> no_long_matches;
+
+		Piece next;
+		while( to_compress.pop( next ) )
+		{
+			std::shared_ptr<Piece> piece = std::make_shared<Piece>( std::move( next ) );
+			pool.spawn( group, [&, piece]()
+			{
+				vector<BYTE> out;
+				Stats piece_stats;
+				compress_piece( piece->chars, piece->history_len, opts, no_long_matches, out, stats ? &piece_stats : NULL );
+				if( stats )
+				{
+					std::lock_guard<std::mutex> lock( stats_mutex );
+					stats->merge( piece_stats );
+				}
+				to_write.put( piece->index, std::move( out ) );
+			} );
 		}
+		pool.wait( group );
+	}
+	to_write.close();
+	reader.join();
+	writer.join();
 
-		if( curr_len > best_len )
-		{
-			best_match = i;
-			best_len = curr_len;
-		}
+	if( !read_ok )
+		std::cerr << "** Could not read all of '" << infile << "'" << std::endl;
+	if( !write_ok )
+		std::cerr << "** Could not write all of '" << outfile << "'" << std::endl;
+
+	cout << "Read in " << bytes_read << " bytes" << endl;
+	if( write_ok )
+		cout << "OK Saved " << bytes_written << " bytes to " << outfile << endl;
+
+	if( stats )
+	{
+		stats->input_secs += read_secs;
+		stats->output_secs += write_secs;
+		stats->output( cout );
 	}
 
-	return best_match;
+	return read_ok && write_ok ? 0 : 1;
 }
 
 //----------------------------------------
 //  Compression
+//	If stats is non-NULL, counters and phase timings are collected into it and printed at the end
 //----------------------------------------
-int compress_main( const string& infile, const string& outfile, bool use_suffix_tree )
+int compress_main( const string& infile, const string& outfile, const CompressOptions& opts, Stats* stats )
 {
+	vector<BYTE> dict;
+	if( !opts.dict_file.empty() && !BitReader::load_bytes_binary( dict, opts.dict_file ) )
+		return 1;
+
+	// Long distance matching has to see the whole input first. Everything else can go as it's read, unless it's
+	// being compressed in place: opening the output would empty the input before any of it was read.
+	if( !opts.long_range && !opts.reference && !file_io::same_file( infile, outfile ) )
+		return compress_stream( infile, outfile, opts, dict, stats );
+
 	//----------------------------------------
-	//  Read the whole file into the array at once
+	//  Read the whole file into the array at once, after the dictionary, as history
 	//----------------------------------------
 	vector<BYTE> bytes;
-
-	std::ifstream fin( infile.c_str(), ios::binary );
-	if( !fin.good() )
-	{
-		std::cerr << "** Could not open file for read '" << infile << "'" << std::endl;
-		return 1;
-	}
-	else
 	{
-		BYTE byte;
-		while( true )
+		ScopedTimer t( stats ? &stats->input_secs : NULL );
+		if( !file_io::read_file( infile, bytes ) )
 		{
-			fin.read( (char*)&byte, sizeof(BYTE) );
-			if( fin.eof() )
-				// done
-				break;
-
-			bytes.push_back( byte );
+			std::cerr << "** Could not read file '" << infile << "'" << std::endl;
+			return 1;
 		}
-	
-		fin.close();
 	}
+	int history_len = dict.size();
+	bytes.insert( bytes.begin(), dict.begin(), dict.end() );
 
-	cout << "Read in " << bytes.size() << " bytes" << endl;
+	cout << "Read in " << bytes.size() - history_len << " bytes" << endl;
 
 	//----------------------------------------
-	//	Main compression loop
+	//	Main compression loop, with the chosen finder
 	//----------------------------------------
-	BitWriter bw;
-
-	SuffixTree stree( bytes, get_max_copy_len() );
-	vector<BYTE> target( get_max_copy_len() );
-
-	for( int i = 0; i < bytes.size(); )
+	vector<BYTE> out;
+	if( opts.num_threads > 1 )
 	{
-		int target_len = min( (size_t)get_max_copy_len(), bytes.size()-i );
-		target.resize( target_len );
-
-		// copy the next target chunk
-		for( int j = 0; j < target_len; j++ )
-		{
-			assert( i+j < bytes.size() );
-			target[j] = bytes[i+j];
-		}
-
-		// search for it in previous bytes
-		// but only look back 4096 bytes tops
-		int pile_start = max( (int)0, (int)(i-get_max_delta()-1) );
-		int best_len = -1;
-		int longest_match = -1;
-		
-		if( use_suffix_tree )
-		{
-			pair<int,int> rv = stree.find_longest_match_after( target, pile_start );
-			longest_match = rv.first;
-			best_len = rv.second;
-			//cout << "found i = " << longest_match << " best_len = " << best_len << endl;
-		}
-		else
-		{
-			// slow brute force
-			longest_match = find_longest_match( bytes, pile_start, i, target, best_len );
-		}
-
-		if( best_len >= 2 )
-		{
-			// compress it!
-			bw.write_bit( 1 );
-			unsigned int delta = i - longest_match - 1;
-			bw.write_bits( delta, NUM_DELTA_BITS );
-			bw.write_bits( best_len, NUM_LEN_BITS );
-#ifdef VERBOSE
-			cout << "copy " << delta << " " << best_len << endl;
-#endif
-
-			// advance cursor past the length
-			i += best_len;
-			// and the suffix tree
-			if( use_suffix_tree )
-			{
-				for( int j = 0; j < best_len; j++ )
-				{
-					bool ok = stree.add_next_letter();
-					assert( ok );
-				}
-			}
-		}
-		else
-		{
-			// didn't find any. just output it
-			bw.write_bit( 0 );
-			bw.write_bits( bytes[i], 8 );
-
-#ifdef VERBOSE
-			cout << "byte " << bytes[i] << endl;
-#endif
-
-			// advance cursor and suffix tree
-			i++;
-			if( use_suffix_tree )
-			{
-				bool ok = stree.add_next_letter();
-				assert( ok );
-			}
-		}
+		WorkerPool pool( opts.num_threads );
+		compress_with_engine( bytes, history_len, opts, out, stats, &pool );
 	}
+	else
+		compress_with_engine( bytes, history_len, opts, out, stats, NULL );
 
 	//----------------------------------------
 	//  Save
 	//----------------------------------------
-	bool ok = bw.save_binary( outfile );
+	bool ok = false;
+	{
+		ScopedTimer t( stats ? &stats->output_secs : NULL );
+		ok = BitWriter::save_bytes_binary( out, outfile );
+	}
+
+	if( stats )
+		stats->output( cout );
 
 	if( ok ) return 0;
 	else return 1;
 }
 
-int decompress_main( const string& infile, const string& outfile )
+//----------------------------------------
+//  Decodes flag bit + literal / copy commands from br onto the end of out, until out has out_limit bytes
+//	or the bits run out. window_bits is what the copy deltas were written with. Returns false (after complaining) on a corrupt command.
+//----------------------------------------
+bool decode_bits( BitReader& br, vector<BYTE>& out, size_t out_limit, unsigned int window_bits )
 {
-	BitReader br;
-	br.load_binary( infile );
-
-	// the uncompressed bytes
-	vector<BYTE> out;
 	int num_commands_read = 0;
 
-	while( true )
+	while( out.size() < out_limit )
 	{
 		bool is_ptr = false;
 		bool ok = br.read_bit( is_ptr );
@@ -205,7 +1018,7 @@ int decompress_main( const string& infile, const string& outfile )
 		{
 			size_t delta = 0;
 			size_t num_bytes = 0;
-			ok = br.read_bits( delta, NUM_DELTA_BITS ) && br.read_bits( num_bytes, NUM_LEN_BITS );
+			ok = read_copy_delta( br, delta, window_bits ) && read_copy_len( br, num_bytes );
 
 			if( !ok )
 			{
@@ -214,23 +1027,18 @@ int decompress_main( const string& infile, const string& outfile )
 			}
 
 			size_t copy_start = out.size()-1-delta;
-			size_t copy_end = copy_start + num_bytes;
 			if( copy_start > out.size() )
 			{
 				cerr << "Bad pointer for copy command #" << num_commands_read << ", delta = " << delta << endl;
-				return 1;
+				return false;
 			}
-			if( copy_end > out.size() )
+			if( num_bytes > out_limit - out.size() )
 			{
 				cerr << "Bad size for copy command #" << num_commands_read << ", nbytes = " << num_bytes << endl;
-				return 1;
+				return false;
 			}
 
-			// copy bytes to end
-			for( int i = copy_start; i < copy_end; i++ )
-			{
-				out.push_back( out[i] );
-			}
+			container::append_copy( out, copy_start, num_bytes );
 		}
 		else
 		{
@@ -248,30 +1056,540 @@ int decompress_main( const string& infile, const string& outfile )
 		num_commands_read++;
 	}
 
+	return true;
+}
+
+// decode_container() sizes its output up front, but not to more than this many times the input
+static const size_t MAX_RESERVE_RATIO = 16;
+
+//----------------------------------------
+//  Decodes all the blocks of a container onto out. Returns false (after complaining) if it's corrupt.
+//	If it was compressed with a dictionary, that has to be dict, and out starts with its history_len bytes.
+//----------------------------------------
+bool decode_container( const vector<BYTE>& in, const vector<BYTE>& dict, vector<BYTE>& out, size_t& history_len )
+{
+	PROFILE_SCOPE( "decode_container" );
+	int window_bits = 0;
+	size_t pos = 0;
+	if( !container::read_header( in, window_bits, pos ) )
+	{
+		cerr << "Bad header" << endl;
+		return false;
+	}
+
+	BitReader br;
+	history_len = 0;
+
+	// Size the output once from the block headers. Growing it as it goes costs a copy of everything so far
+	// now and then, and that's a good part of the time for the token format.
+	// The headers haven't been checked yet, so only count what they could really hold, and no more than
+	// MAX_RESERVE_RATIO times the input in all. Copy blocks and anything past that are left to grow into.
+	size_t total_len = out.size();
+	for( size_t p = pos; p < in.size() && in[p] != container::BLOCK_END && in.size() - p >= container::BLOCK_HEADER_SIZE; )
+	{
+		uint32_t raw_len = container::read_u32( &in[p+1] );
+		if( in[p] == container::BLOCK_DICT )
+			total_len += dict.size();
+		else if( in[p] != container::BLOCK_COPY )
+			total_len += min( raw_len, (uint32_t)container::BLOCK_SIZE );
+		p += container::BLOCK_HEADER_SIZE + (size_t)container::read_u32( &in[p+5] );
+	}
+	out.reserve( min( total_len, out.size() + dict.size() + MAX_RESERVE_RATIO * in.size() ) );
+
+	for( int block = 0; ; block++ )
+	{
+		if( pos >= in.size() )
+		{
+			cerr << "Truncated file, no end block" << endl;
+			return false;
+		}
+
+		BYTE type = in[pos];
+		if( type == container::BLOCK_END )
+			return true;
+
+		if( in.size() - pos < container::BLOCK_HEADER_SIZE )
+		{
+			cerr << "Truncated header for block #" << block << endl;
+			return false;
+		}
+		uint32_t raw_len = container::read_u32( &in[pos+1] );
+		uint32_t payload_len = container::read_u32( &in[pos+5] );
+		pos += container::BLOCK_HEADER_SIZE;
+
+		if( payload_len > in.size() - pos )
+		{
+			cerr << "Truncated payload for block #" << block << endl;
+			return false;
+		}
+		if( raw_len > container::BLOCK_SIZE && type != container::BLOCK_COPY && type != container::BLOCK_DICT )
+		{
+			// only copy blocks and the dictionary are ever bigger
+			cerr << "Bad size for block #" << block << endl;
+			return false;
+		}
+		const BYTE* payload = in.data() + pos;
+		size_t out_end = out.size() + raw_len;
+		// growing to just fit each block would copy everything so far every time
+		if( out_end > out.capacity() )
+			out.reserve( max( out_end, 2*out.capacity() ) );
+
+		if( type == container::BLOCK_STORED )
+		{
+			if( payload_len != raw_len )
+			{
+				cerr << "Bad size for stored block #" << block << endl;
+				return false;
+			}
+			out.insert( out.end(), payload, payload+payload_len );
+		}
+		else if( type == container::BLOCK_DICT )
+		{
+			if( block != 0 || payload_len != 4 )
+			{
+				cerr << "Bad dictionary block #" << block << endl;
+				return false;
+			}
+			if( dict.size() != raw_len || dictionary::checksum( dict ) != container::read_u32( payload ) )
+			{
+				cerr << "This was compressed with a " << raw_len << " byte dictionary, and not the one given" << endl;
+				return false;
+			}
+			out.insert( out.end(), dict.begin(), dict.end() );
+			history_len = raw_len;
+		}
+		else if( type == container::BLOCK_COPY )
+		{
+			uint32_t src = payload_len == 4 ? container::read_u32( payload ) : 0;
+			if( payload_len != 4 || src >= out.size() )
+			{
+				cerr << "Bad source for copy block #" << block << endl;
+				return false;
+			}
+			container::append_copy( out, src, raw_len );
+		}
+		else if( type == container::BLOCK_BITS )
+		{
+			br.assign( payload, payload_len );
+			if( !decode_bits( br, out, out_end, window_bits ) )
+				return false;
+		}
+		else if( type == container::BLOCK_TOKENS )
+		{
+			if( !token_format::decode( payload, payload_len, out, out_end, window_bits ) )
+			{
+				cerr << "Corrupt tokens in block #" << block << endl;
+				return false;
+			}
+		}
+		else if( type == container::BLOCK_FLAGS )
+		{
+			if( !flag_format::decode( payload, payload_len, out, out_end, window_bits ) )
+			{
+				cerr << "Corrupt commands in block #" << block << endl;
+				return false;
+			}
+		}
+		else if( type == container::BLOCK_STREAMS )
+		{
+			if( !stream_format::decode( payload, payload_len, out, out_end, window_bits ) )
+			{
+				cerr << "Corrupt streams in block #" << block << endl;
+				return false;
+			}
+		}
+		else
+		{
+			cerr << "Unknown type " << (int)type << " for block #" << block << endl;
+			return false;
+		}
+
+		if( out.size() != out_end )
+		{
+			cerr << "Block #" << block << " decoded to " << out.size() - (out_end - raw_len) << " bytes instead of " << raw_len << endl;
+			return false;
+		}
+		pos += payload_len;
+	}
+}
+
+//----------------------------------------
+//  Decodes a whole compressed file, container or not, into out. Returns false (after complaining) if it's corrupt.
+//----------------------------------------
+bool decompress_bytes( const vector<BYTE>& in, const vector<BYTE>& dict, vector<BYTE>& out )
+{
+	if( container::has_header( in ) )
+	{
+		size_t history_len = 0;
+		if( !decode_container( in, dict, out, history_len ) )
+			return false;
+		out.erase( out.begin(), out.begin() + history_len );
+	}
+	else
+	{
+		// the original headerless bit stream, which just ends when the bits do
+		BitReader br;
+		br.assign( in.data(), in.size() );
+		if( !decode_bits( br, out, (size_t)-1, NUM_DELTA_BITS ) )
+			return false;
+	}
+	return true;
+}
+
+int decompress_main( const string& infile, const string& outfile, const string& dict_file )
+{
+	vector<BYTE> in;
+	if( !BitReader::load_bytes_binary( in, infile ) )
+		return 1;
+
+	vector<BYTE> dict;
+	if( !dict_file.empty() && !BitReader::load_bytes_binary( dict, dict_file ) )
+		return 1;
+
+	// the uncompressed bytes
+	vector<BYTE> out;
+	if( !decompress_bytes( in, dict, out ) )
+		return 1;
+
 	// write out!
-	BitWriter::save_bytes_binary( out, outfile );
+	return BitWriter::save_bytes_binary( out, outfile ) ? 0 : 1;
+}
 
-	return 0;
+inline bool ends_with( const string& s, const string& suffix )
+{
+	return s.size() >= suffix.size() && s.compare( s.size() - suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+//----------------------------------------
+//  Compresses (or with mode 'd', decompresses) many files in one go, on opts.num_threads threads.
+//	inputs can be files or directories, which are gone through recursively, and list_file (if given) names more
+//	files, one per line. Compressed files get suffix added, and decompressing takes it off again (or adds ".out").
+//	Each file is handled as if on its own, but the process, the threads and the dictionary are only set up once.
+//	Files are tasks in a work-stealing pool, and big ones split into pieces that idle threads can steal too.
+//	If stats is non-NULL, compressing collects them for every file and prints the total at the end.
+//----------------------------------------
+int batch_main( char mode, const vector<string>& inputs, const string& list_file, const string& suffix, const CompressOptions& opts, Stats* stats )
+{
+	bool compress = mode != 'd';
+
+	vector<string> files;
+	for( size_t n = 0; n < inputs.size(); n++ )
+	{
+		if( !file_io::is_directory( inputs[n] ) )
+		{
+			files.push_back( inputs[n] );
+			continue;
+		}
+
+		vector<string> found;
+		if( !file_io::list_files( inputs[n], found ) )
+			cerr << "** Could not list everything under '" << inputs[n] << "'" << endl;
+		for( size_t f = 0; f < found.size(); f++ )
+		{
+			// so running it again doesn't compress the last run's output, or decompress its input
+			if( ends_with( found[f], suffix ) == compress )
+				continue;
+			files.push_back( found[f] );
+		}
+	}
+
+	if( !list_file.empty() )
+	{
+		std::ifstream fin( list_file.c_str() );
+		if( !fin.good() )
+		{
+			cerr << "** Could not open file list '" << list_file << "'" << endl;
+			return 1;
+		}
+		string line;
+		while( getline( fin, line ) )
+		{
+			if( !line.empty() )
+				files.push_back( line );
+		}
+	}
+
+	vector<BYTE> dict;
+	if( !opts.dict_file.empty() && !file_io::read_file( opts.dict_file, dict ) )
+	{
+		cerr << "** Could not read dictionary '" << opts.dict_file << "'" << endl;
+		return 1;
+	}
+
+	// Biggest first. Other threads steal the oldest tasks, so they start on the big ones while the small
+	// ones fill in the gaps at the end.
+	vector< pair<size_t,string> > by_size( files.size() );
+	for( size_t f = 0; f < files.size(); f++ )
+		by_size[f] = make_pair( file_io::file_size( files[f] ), files[f] );
+	stable_sort( by_size.begin(), by_size.end(), []( const pair<size_t,string>& a, const pair<size_t,string>& b ) { return a.first > b.first; } );
+	for( size_t f = 0; f < files.size(); f++ )
+		files[f] = by_size[f].second;
+
+	std::atomic<size_t> num_failed( 0 );
+	std::atomic<size_t> bytes_in( 0 );
+	std::atomic<size_t> bytes_out( 0 );
+	std::mutex err_mutex;
+
+	WorkerPool pool( opts.num_threads );
+	WorkerPool::TaskGroup group;
+	auto do_file = [&]( size_t f )
+	{
+		const string& infile = files[f];
+		string outfile = infile + suffix;
+		if( !compress )
+			outfile = ends_with( infile, suffix ) ? infile.substr( 0, infile.size() - suffix.size() ) : infile + ".out";
+
+		vector<BYTE> in;
+		vector<BYTE> out;
+		// this file's, added to the total at the end
+		Stats file_stats;
+		Stats* file_stats_ptr = stats ? &file_stats : NULL;
+		// what went wrong, and with which file
+		const char* problem = NULL;
+		const string* culprit = &infile;
+		bool read_ok = false;
+		{
+			ScopedTimer t( stats ? &file_stats.input_secs : NULL );
+			read_ok = file_io::read_file( infile, in );
+		}
+		if( !read_ok )
+			problem = "Could not read";
+		else if( compress )
+		{
+			// the dictionary goes first, as history
+			vector<BYTE> bytes;
+			bytes.reserve( dict.size() + in.size() );
+			bytes.insert( bytes.end(), dict.begin(), dict.end() );
+			bytes.insert( bytes.end(), in.begin(), in.end() );
+			compress_with_engine( bytes, dict.size(), opts, out, file_stats_ptr, &pool );
+		}
+		else if( !decompress_bytes( in, dict, out ) )
+			problem = "Could not decompress";
+
+		if( problem == NULL )
+		{
+			ScopedTimer t( stats ? &file_stats.output_secs : NULL );
+			if( !file_io::write_file( outfile, out.data(), out.size() ) )
+			{
+				problem = "Could not write";
+				culprit = &outfile;
+			}
+		}
+
+		if( problem != NULL )
+		{
+			std::lock_guard<std::mutex> lock( err_mutex );
+			cerr << "** " << problem << " '" << *culprit << "'" << endl;
+			num_failed++;
+			return;
+		}
+		bytes_in += in.size();
+		bytes_out += out.size();
+		if( stats )
+		{
+			std::lock_guard<std::mutex> lock( err_mutex );
+			stats->merge( file_stats );
+		}
+	};
+
+	for( size_t f = 0; f < files.size(); f++ )
+		pool.spawn( group, [&do_file, f]() { do_file( f ); } );
+	pool.wait( group );
+
+	cout << (compress ? "Compressed " : "Decompressed ") << files.size() - num_failed << " of " << files.size() << " files, "
+		<< bytes_in << " bytes to " << bytes_out << " bytes" << endl;
+
+	// all the files together. Like a single input's pieces, the times are added up across threads.
+	if( stats && compress )
+		stats->output( cout );
+
+	return num_failed == 0 ? 0 : 1;
+}
+
+//----------------------------------------
+//  Builds a dictionary from the sample files, and saves it to dictfile.
+//	args are the samples, with maybe a --size option.
+//----------------------------------------
+int train_main( const string& dictfile, int argc, char** argv )
+{
+	size_t dict_size = get_max_delta()+1;
+	vector< vector<BYTE> > samples;
+	for( int i = 0; i < argc; i++ )
+	{
+		string arg( argv[i] );
+		if( arg == "--size" && i+1 < argc )
+			dict_size = atoi( argv[++i] );
+		else
+		{
+			samples.push_back( vector<BYTE>() );
+			if( !BitReader::load_bytes_binary( samples.back(), arg ) )
+				return 1;
+		}
+	}
+
+	vector<BYTE> dict = dictionary::train( samples, dict_size );
+	return BitWriter::save_bytes_binary( dict, dictfile ) ? 0 : 1;
+}
+
+//----------------------------------------
+//  Prints how to run it, and returns the exit code for a bad command line
+//----------------------------------------
+int usage( const char* prog )
+{
+	cerr << "Usage: " << prog << " [c|d|s|b|a] infile outfile [-m engine] [-f] [-w bits] [--long] [-D dict] [-r reference] [-j threads] [--stats]" << endl;
+	cerr << "       " << prog << " [c|d|s|b|a] --batch [options] files and directories... [-l listfile] [--suffix .alz]" << endl;
+	cerr << "       " << prog << " train dictfile sample1 [sample2 ...] [--size bytes]" << endl;
+	cerr << "[c|d|s|b|a] indicates whether to compress or decompress. 's' indicates slow 'brute force' compression, just for testing." << endl;
+	cerr << "'b' and 'a' are short for 'c -m bt' and 'c -m sa'." << endl;
+	cerr << "-m picks the match finder to compress with:" << endl;
+	cerr << "    st  suffix tree (default)" << endl;
+	cerr << "    bf  brute force, exact and slow" << endl;
+	cerr << "    bt  binary tree over the window, faster and uses less memory than the suffix tree" << endl;
+	cerr << "    sa  per-block suffix arrays with predictable memory, exact like bf and far faster" << endl;
+	cerr << "    ht  a single-probe hash table, the fastest by far but it misses the most" << endl;
+	cerr << "-1 to -9 pick a compression level, from fastest to smallest. They set -m, -f, -w, --depth, --lazy, --long and --format," << endl;
+	cerr << "   and options after them override what they set. On the make bench_levels input -1 is about 10x faster than -9 and 5% bigger." << endl;
+	cerr << "-f is fast mode: index fewer positions inside copies, and search less often where nothing matches." << endl;
+	cerr << "--depth sets how many candidates the bt finder looks at per position (64 by default). Fewer is faster." << endl;
+	cerr << "--lazy parses lazily, putting off a copy by a byte when the next position has a better one. A bit slower, a bit smaller." << endl;
+	cerr << "--format tokens writes byte-aligned tokens instead of the default bit stream: usually 10-30% bigger, but 2-3x faster to decompress." << endl;
+	cerr << "--format flags keeps the bit stream's commands but makes them byte-aligned, with their flags packed 32 to a word. About as big and fast as tokens." << endl;
+	cerr << "--format streams is tokens with the lengths, literals and deltas in separate streams, decoded side by side." << endl;
+	cerr << "-w sets the window to 2^bits bytes, from " << container::MIN_WINDOW_BITS << " (4KB, the default) to " << container::MAX_WINDOW_BITS << " (64MB)." << endl;
+	cerr << "   Bigger windows find more distant matches, but every copy costs more bits and the finders use more memory." << endl;
+	cerr << "--long first looks for long repeats anywhere in the file, however far apart, and codes them as single copies." << endl;
+	cerr << "-D compresses or decompresses with a dictionary, bytes treated as coming before the input. It has to be the same both ways." << endl;
+	cerr << "-r is -D for a reference file, eg. the previous version of the input, so the output is a delta against it." << endl;
+	cerr << "   The window widens to take in the whole reference, and --long is on. Decompress with -r or -D and the same file." << endl;
+	cerr << "train builds a dictionary (of the default window size, 4KB, unless --size says otherwise) from samples like the files to compress." << endl;
+	cerr << "-j sets how many threads compress at once, one per core by default. Inputs over 1MB are split into pieces for them." << endl;
+	cerr << "--batch does many files at once, going through directories recursively." << endl;
+	cerr << "   -l names a file listing more inputs, one per line. Outputs get --suffix (.alz by default) added, or taken off to decompress." << endl;
+	cerr << "--uring reads and writes files through io_uring, queueing several requests per system call, where the kernel has it." << endl;
+	cerr << "--sync data or full flushes outputs to the disk (fdatasync or fsync) before counting them as written. none, the default, leaves it to the OS." << endl;
+	cerr << "--stats prints command counts, copy histograms, search effort and phase timings after compressing, totalled over all the files with --batch." << endl;
+	return 1;
 }
 
 int main( int argc, char** argv )
 {
 	if( argc < 4 )
+		return usage( argv[0] );
+
+	string mode_arg( argv[1] );
+	if( mode_arg == "train" )
+		return train_main( argv[2], argc-3, argv+3 );
+	if( mode_arg != "c" && mode_arg != "d" && mode_arg != "s" && mode_arg != "b" && mode_arg != "a" )
 	{
-		cerr << "Usage: " << argv[0] << " [c|d|s] infile outfile" << endl;
-		cerr << "[c|d|s] indicates whether to compress or decompress. 's' indicates slow 'brute force' compression, just for testing." << endl;
-		return 1;
+		cerr << "Unknown mode '" << mode_arg << "'" << endl;
+		return usage( argv[0] );
 	}
+	char mode = mode_arg[0];
 
-	char mode = argv[1][0];
+	bool batch = string( argv[2] ) == "--batch";
 	string infile( argv[2] );
 	string outfile( argv[3] );
 
-	if( mode == 'c' )
-		return compress_main( infile, outfile, true );
-	else if( mode == 's' )
+	// batch mode's inputs and options
+	vector<string> inputs;
+	string list_file;
+	string suffix( ".alz" );
+
+	CompressOptions opts;
+	opts.num_threads = default_num_threads();
+	if( mode == 's' )
 		// Use the 's'low compression method, just for testing
-		return compress_main( infile, outfile, false );
+		opts.engine = ENGINE_BRUTE_FORCE;
+	else if( mode == 'b' )
+		opts.engine = ENGINE_BINARY_TREE;
+	else if( mode == 'a' )
+		opts.engine = ENGINE_SUFFIX_ARRAY;
+
+	Stats stats;
+	Stats* stats_ptr = NULL;
+	for( int i = batch ? 3 : 4; i < argc; i++ )
+	{
+		string arg( argv[i] );
+		if( arg == "-j" && i+1 < argc )
+			opts.num_threads = max( 1, atoi( argv[++i] ) );
+		else if( batch && arg == "-l" && i+1 < argc )
+			list_file = argv[++i];
+		else if( batch && arg == "--suffix" && i+1 < argc )
+			suffix = argv[++i];
+		else if( batch && arg[0] != '-' )
+			inputs.push_back( arg );
+		else if( arg == "--stats" )
+			stats_ptr = &stats;
+		else if( arg == "--uring" )
+			file_io::use_io_uring() = true;
+		else if( arg == "--sync" && i+1 < argc )
+		{
+			string policy( argv[++i] );
+			if( policy == "none" )
+				file_io::sync_policy() = file_io::SYNC_NONE;
+			else if( policy == "data" )
+				file_io::sync_policy() = file_io::SYNC_DATA;
+			else if( policy == "full" )
+				file_io::sync_policy() = file_io::SYNC_FULL;
+			else
+			{
+				cerr << "--sync takes none, data or full" << endl;
+				return 1;
+			}
+		}
+		else if( arg == "--long" )
+			opts.long_range = true;
+		else if( arg == "-f" )
+			opts.fast = true;
+		else if( arg == "--lazy" )
+			opts.lazy = true;
+		else if( arg == "--format" && i+1 < argc )
+		{
+			if( !parse_format( argv[++i], opts.format ) )
+			{
+				cerr << "--format takes bits, tokens, flags or streams" << endl;
+				return 1;
+			}
+		}
+		else if( arg == "--depth" && i+1 < argc )
+			opts.search_depth = max( 1, atoi( argv[++i] ) );
+		else if( arg.size() == 2 && arg[0] == '-' && arg[1] >= '0' + MIN_LEVEL && arg[1] <= '0' + MAX_LEVEL )
+			apply_level( arg[1] - '0', opts );
+		else if( arg == "-D" && i+1 < argc )
+			opts.dict_file = argv[++i];
+		else if( arg == "-r" && i+1 < argc )
+		{
+			opts.dict_file = argv[++i];
+			opts.reference = true;
+		}
+		else if( arg == "-w" && i+1 < argc )
+		{
+			opts.window_bits = atoi( argv[++i] );
+			if( opts.window_bits < container::MIN_WINDOW_BITS || opts.window_bits > container::MAX_WINDOW_BITS )
+			{
+				cerr << "Window bits must be from " << container::MIN_WINDOW_BITS << " to " << container::MAX_WINDOW_BITS << endl;
+				return 1;
+			}
+		}
+		else if( arg == "-m" && i+1 < argc )
+		{
+			if( !parse_engine( argv[++i], opts.engine ) )
+			{
+				cerr << "Unknown match finder '" << argv[i] << "'" << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			cerr << "Unknown option '" << argv[i] << "'" << endl;
+			return 1;
+		}
+	}
+
+	if( batch )
+		return batch_main( mode, inputs, list_file, suffix, opts, stats_ptr );
+	else if( mode == 'c' || mode == 's' || mode == 'b' || mode == 'a' )
+		return compress_main( infile, outfile, opts, stats_ptr );
 	else
-		return decompress_main( infile, outfile );
+		return decompress_main( infile, outfile, opts.dict_file );
 }
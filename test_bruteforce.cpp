@@ -0,0 +1,39 @@
+#include <iostream>
+#include <cstdlib>
+#include "BruteForce.hpp"
+
+using namespace std;
+
+// Checks the vectorized brute force search against the naive one, on random windows over small alphabets
+int main( int argc, char** argv )
+{
+	int num_trials = argc > 1 ? atoi(argv[1]) : 20000;
+
+	for( int trial = 0; trial < num_trials; trial++ )
+	{
+		int alphabet = 1 + rand() % 4;
+		vector<BYTE> pile( rand() % 200 );
+		for( int i = 0; i < (int)pile.size(); i++ )
+			pile[i] = rand() % alphabet;
+
+		vector<BYTE> target( rand() % 20 );
+		for( int i = 0; i < (int)target.size(); i++ )
+			target[i] = rand() % alphabet;
+
+		int pile_end = pile.empty() ? 0 : rand() % (pile.size()+1);
+		int pile_start = pile_end == 0 ? 0 : rand() % (pile_end+1);
+
+		int naive_len = 0, fast_len = 0;
+		int naive_pos = find_longest_match_naive( pile, pile_start, pile_end, target, naive_len );
+		int fast_pos = find_longest_match( pile, pile_start, pile_end, target, fast_len );
+
+		if( naive_pos != fast_pos || naive_len != fast_len )
+		{
+			cerr << "Mismatch on trial " << trial << ": naive " << naive_pos << "," << naive_len
+				<< " fast " << fast_pos << "," << fast_len << endl;
+			return 1;
+		}
+	}
+
+	cout << "OK " << num_trials << " trials" << endl;
+}
@@ -0,0 +1,39 @@
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <vector>
+#include "MatchLength.hpp"
+
+using namespace std;
+
+// Checks every match length kernel against the obvious byte loop, on random buffers with planted common prefixes
+int main( int argc, char** argv )
+{
+	int num_trials = argc > 1 ? atoi(argv[1]) : 100000;
+
+	vector<BYTE> a( 300 ), b( 300 );
+	for( int trial = 0; trial < num_trials; trial++ )
+	{
+		int common = rand() % 300;
+		for( int i = 0; i < 300; i++ )
+		{
+			a[i] = rand() % 4;
+			b[i] = i < common ? a[i] : rand() % 4;
+		}
+		int max_len = rand() % 301;
+
+		int expected = 0;
+		while( expected < max_len && a[expected] == b[expected] )
+			expected++;
+
+		assert( match_length_impl::scalar( &a[0], &b[0], max_len ) == expected );
+#ifdef ALZ_X86_SIMD
+		assert( match_length_impl::sse2( &a[0], &b[0], max_len ) == expected );
+		if( __builtin_cpu_supports( "avx2" ) )
+			assert( match_length_impl::avx2( &a[0], &b[0], max_len ) == expected );
+#endif
+		assert( match_length( &a[0], &b[0], max_len ) == expected );
+	}
+
+	cout << "OK " << num_trials << " trials, using the " << match_length_impl::kernel_name() << " kernel" << endl;
+}
@@ -0,0 +1,61 @@
+#include <iostream>
+#include <cstdlib>
+#include "SuffixArray.hpp"
+#include "BruteForce.hpp"
+
+using namespace std;
+
+// Checks SA-IS against a plain sort, and the windowed queries, with the default settings, against the brute force search
+int main( int argc, char** argv )
+{
+	int num_trials = argc > 1 ? atoi(argv[1]) : 2000;
+
+	for( int trial = 0; trial < num_trials; trial++ )
+	{
+		int alphabet = 1 + rand() % 4;
+		vector<BYTE> chars( 1 + rand() % 500 );
+		for( int i = 0; i < (int)chars.size(); i++ )
+			chars[i] = 'a' + rand() % alphabet;
+		if( trial % 2 )
+		{
+			// a short pattern over and over, with the odd change, so lots of suffixes share long prefixes
+			int period = 1 + rand() % 8;
+			for( int i = period; i < (int)chars.size(); i++ )
+				chars[i] = rand() % 50 ? chars[i-period] : 'a' + rand() % alphabet;
+		}
+
+		vector<int> s( chars.begin(), chars.end() );
+		if( suffix_array_impl::sa_is( s, 255 ) != suffix_array_impl::sa_naive( s ) )
+		{
+			cerr << "Suffix array mismatch on trial " << trial << endl;
+			return 1;
+		}
+
+		// small windows and blocks, so the block boundaries get exercised
+		int max_len = 15;
+		int window = 1 + rand() % 64;
+		SuffixArray sarray( chars, max_len, window, 1 + rand() % 100 );
+		for( int i = 0; i < (int)chars.size(); i++ )
+		{
+			vector<BYTE> target( chars.begin()+i, chars.begin() + min( (int)chars.size(), i+max_len ) );
+			int min_pos = max( 0, i-window );
+			pair<int,int> rv = sarray.find_longest_match_after( target, min_pos );
+
+			int best_len = 0;
+			find_longest_match( chars, min_pos, i, target, best_len );
+			if( max( best_len, 0 ) != rv.second )
+			{
+				cerr << "Match length mismatch on trial " << trial << " at " << i << ": expected " << best_len << " got " << rv.second << endl;
+				return 1;
+			}
+			if( rv.second > 0 && !equal( target.begin(), target.begin()+rv.second, chars.begin()+rv.first ) )
+			{
+				cerr << "Bad match position on trial " << trial << " at " << i << endl;
+				return 1;
+			}
+			sarray.add_next_letter();
+		}
+	}
+
+	cout << "OK " << num_trials << " trials" << endl;
+}